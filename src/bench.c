@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "fs.h"
+
+//benchmark definitions
+#define BENCH_IMAGE "bench.img"
+#define BENCH_MOUNTS 20 //mount and un-mount cycles timed per geometry
+#define BENCH_SMALL_WRITE 64    //bytes per small write
+#define BENCH_LARGE_WRITE (1 << 20) //bytes per large write
+#define BENCH_FILE_BYTES (16 << 20) //bytes written by each sequential write benchmark
+#define BENCH_READ_SIZE (64 << 10)  //bytes per sequential read
+#define BENCH_SEEKS 100000  //random seeks timed per geometry
+#define BENCH_CHAINS 8  //long chains deleted per geometry
+#define BENCH_CHAIN_BYTES (1 << 20) //bytes in each of them
+#define BENCH_SYNCS 50  //durable syncs timed per geometry
+#define BENCH_THREADS_MAX 8 //the scaling benchmark runs 1, 2, 4 ... up to this many threads at once
+#define BENCH_THREAD_OPS 20000  //small writes, then as many reads, each thread makes on a file of its own
+
+//geometry sweep, every benchmark runs once for each block size and file count
+static const int blockSizes[] = {512, 4096};
+static const int fileCounts[] = {100, 1000};
+
+//latencies of the operations of one benchmark, in microseconds
+typedef struct samples {
+    double *latency;
+    int count;
+    int capacity;
+}samples;
+
+static char buffer[BENCH_LARGE_WRITE];
+
+double now_us() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e6 + t.tv_nsec / 1e3;
+}
+
+void record(samples *s, double start) {
+    if (s->count == s->capacity) {
+        s->capacity = s->capacity == 0 ? 1024 : s->capacity * 2;
+        s->latency = realloc(s->latency, s->capacity * sizeof(double));
+    }
+    s->latency[s->count++] = now_us() - start;
+}
+
+int compareLatency(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+double percentile(samples *s, double p) {
+    if (s->count == 0) return 0;
+    int at = (int) (p * (s->count - 1) + 0.5);
+    return s->latency[at];
+}
+
+/*
+ * prints one result as a line of JSON and empties the samples
+ * ops/s counts the timed operations over the time spent in them, MB/s the bytes they moved over the same time
+ */
+void report(const char *name, int blockSize, int files, samples *s, double bytes) {
+    double total = 0;
+    for (int i = 0; i < s->count; i++) total += s->latency[i];
+    qsort(s->latency, s->count, sizeof(double), compareLatency);
+    double seconds = total / 1e6;
+    printf("{\"bench\": \"%s\", \"block_size\": %d, \"files\": %d, \"ops\": %d, \"seconds\": %.6f, "
+           "\"ops_per_sec\": %.1f, \"mb_per_sec\": %.2f, \"p50_us\": %.2f, \"p99_us\": %.2f}\n",
+           name, blockSize, files, s->count, seconds, seconds > 0 ? s->count / seconds : 0,
+           seconds > 0 ? bytes / (1 << 20) / seconds : 0, percentile(s, 0.50), percentile(s, 0.99));
+    fflush(stdout);
+    s->count = 0;
+}
+
+//blocks a geometry needs to hold the largest benchmark file alongside the rest, with room to spare
+int blocksFor(int blockSize, int files) {
+    return (int) (((int64_t) BENCH_FILE_BYTES * 2 + (int64_t) BENCH_CHAINS * BENCH_CHAIN_BYTES) / blockSize) + files * 2 + 64;
+}
+
+fileSystem *freshVolume(int blockSize, int files, int flags) {
+    if (make_fs(BENCH_IMAGE, blockSize, blocksFor(blockSize, files), files) == ERR) return NULL;
+    return mount_fs(BENCH_IMAGE, flags);
+}
+
+//creates (and closes) a file per directory entry then times mounting and un-mounting the populated image
+int benchMount(int blockSize, int files, samples *s) {
+    fileSystem *volume = freshVolume(blockSize, files, MOUNT_BUFFERED | DURABLE_NONE);
+    if (volume == NULL) return ERR;
+    char name[FILE_NAME_SIZE];
+    for (int i = 0; i < files; i++) {
+        snprintf(name, sizeof(name), "file-%d", i);
+        fs_close(volume, fs_create(volume, name));
+    }
+    if (umount_fs(volume) == ERR) return ERR;
+
+    int modes[] = {MOUNT_BUFFERED, MOUNT_MMAP};
+    const char *names[] = {"mount_umount_buffered", "mount_umount_mmap"};
+    for (int m = 0; m < 2; m++) {
+        for (int i = 0; i < BENCH_MOUNTS; i++) {
+            double start = now_us();
+            volume = mount_fs(BENCH_IMAGE, modes[m] | DURABLE_NONE);
+            if (volume == NULL || umount_fs(volume) == ERR) return ERR;
+            record(s, start);
+        }
+        report(names[m], blockSize, files, s, 0);
+    }
+    return SUC;
+}
+
+//times creating a file per directory entry, each create is followed by the close that syncs it
+int benchCreate(int blockSize, int files, samples *s) {
+    fileSystem *volume = freshVolume(blockSize, files, MOUNT_BUFFERED | DURABLE_NONE);
+    if (volume == NULL) return ERR;
+    char name[FILE_NAME_SIZE];
+    for (int i = 0; i < files; i++) {
+        snprintf(name, sizeof(name), "file-%d", i);
+        double start = now_us();
+        int fd = fs_create(volume, name);
+        if (fd == ERR || fs_close(volume, fd) == ERR) return ERR;
+        record(s, start);
+    }
+    report("create", blockSize, files, s, 0);
+    return umount_fs(volume);
+}
+
+/*
+ * times sequential writes of a small and a large size, then reading the large file back, seeking about
+ * it at random and deleting long chains, all on one buffered mount
+ */
+int benchData(int blockSize, int files, samples *s) {
+    fileSystem *volume = freshVolume(blockSize, files, MOUNT_BUFFERED | DURABLE_NONE);
+    if (volume == NULL) return ERR;
+
+    int fd = fs_create(volume, "small");
+    for (int written = 0; written < BENCH_FILE_BYTES; written += BENCH_SMALL_WRITE) {
+        double start = now_us();
+        if (fs_write(volume, fd, buffer, BENCH_SMALL_WRITE) != BENCH_SMALL_WRITE) return ERR;
+        record(s, start);
+    }
+    report("write_small", blockSize, files, s, BENCH_FILE_BYTES);
+    fs_close(volume, fd);
+
+    fd = fs_create(volume, "large");
+    for (int written = 0; written < BENCH_FILE_BYTES; written += BENCH_LARGE_WRITE) {
+        double start = now_us();
+        if (fs_write(volume, fd, buffer, BENCH_LARGE_WRITE) != BENCH_LARGE_WRITE) return ERR;
+        record(s, start);
+    }
+    report("write_large", blockSize, files, s, BENCH_FILE_BYTES);
+    fs_close(volume, fd);
+
+    fd = fs_open(volume, "large", O_RDONLY);
+    for (int read = 0; read < BENCH_FILE_BYTES; read += BENCH_READ_SIZE) {
+        double start = now_us();
+        if (fs_read(volume, fd, buffer, BENCH_READ_SIZE) != BENCH_READ_SIZE) return ERR;
+        record(s, start);
+    }
+    report("read_seq", blockSize, files, s, BENCH_FILE_BYTES);
+
+    srand(blockSize + files);
+    for (int i = 0; i < BENCH_SEEKS; i++) {
+        off_t offset = ((off_t) rand() * RAND_MAX + rand()) % BENCH_FILE_BYTES;
+        double start = now_us();
+        if (fs_lseek(volume, fd, offset) == ERR) return ERR;
+        record(s, start);
+    }
+    report("lseek_random", blockSize, files, s, 0);
+    fs_close(volume, fd);
+
+    char name[FILE_NAME_SIZE];
+    for (int i = 0; i < BENCH_CHAINS; i++) {
+        snprintf(name, sizeof(name), "chain-%d", i);
+        fd = fs_create(volume, name);
+        if (fs_write(volume, fd, buffer, BENCH_CHAIN_BYTES) != BENCH_CHAIN_BYTES) return ERR;
+        fs_close(volume, fd);
+    }
+    for (int i = 0; i < BENCH_CHAINS; i++) {
+        snprintf(name, sizeof(name), "chain-%d", i);
+        double start = now_us();
+        if (fs_delete(volume, name) == ERR) return ERR;
+        record(s, start);
+    }
+    report("delete_chain", blockSize, files, s, 0);
+
+    return umount_fs(volume);
+}
+
+//one thread of the scaling benchmark, it keeps its own samples so the threads never share one
+typedef struct benchThread {
+    fileSystem *volume;
+    int index;
+    samples s;
+    int failed;
+}benchThread;
+
+//writes a file of the thread's own in small writes then reads it back in reads of the same size, timing each call
+void *threadWork(void *arg) {
+    benchThread *t = arg;
+    char name[FILE_NAME_SIZE], in[BENCH_SMALL_WRITE];
+    snprintf(name, sizeof(name), "thread-%d", t->index);
+    int fd = fs_create(t->volume, name);
+    for (int i = 0; i < BENCH_THREAD_OPS && !t->failed; i++) {
+        double start = now_us();
+        if (fs_write(t->volume, fd, buffer, BENCH_SMALL_WRITE) != BENCH_SMALL_WRITE) t->failed = TRUE;
+        record(&t->s, start);
+    }
+    if (fs_close(t->volume, fd) == ERR) t->failed = TRUE;
+
+    fd = fs_open(t->volume, name, O_RDONLY);
+    for (int i = 0; i < BENCH_THREAD_OPS && !t->failed; i++) {
+        double start = now_us();
+        if (fs_read(t->volume, fd, in, BENCH_SMALL_WRITE) != BENCH_SMALL_WRITE) t->failed = TRUE;
+        record(&t->s, start);
+    }
+    if (fs_close(t->volume, fd) == ERR) t->failed = TRUE;
+    return NULL;
+}
+
+/*
+ * times threads writing and reading files of their own on one volume, for each thread count up to BENCH_THREADS_MAX
+ * the calls of different files share no lock but the volume's, so ops/s should grow with the threads
+ * ops/s here is over the wall time of the run rather than the time spent in calls, which overlap
+ */
+int benchThreads(int blockSize, int files, samples *s) {
+    for (int threads = 1; threads <= BENCH_THREADS_MAX; threads *= 2) {
+        fileSystem *volume = freshVolume(blockSize, files, MOUNT_BUFFERED | DURABLE_NONE);
+        if (volume == NULL) return ERR;
+        pthread_t workers[BENCH_THREADS_MAX];
+        benchThread work[BENCH_THREADS_MAX] = {0};
+
+        double start = now_us();
+        for (int i = 0; i < threads; i++) {
+            work[i] = (benchThread) {volume, i, {0}, FALSE};
+            if (pthread_create(&workers[i], NULL, threadWork, &work[i]) != 0) return ERR;
+        }
+        int failed = FALSE;
+        for (int i = 0; i < threads; i++) {
+            pthread_join(workers[i], NULL);
+            failed |= work[i].failed;
+        }
+        double seconds = (now_us() - start) / 1e6;
+
+        for (int i = 0; i < threads; i++) {
+            for (int j = 0; j < work[i].s.count; j++) {
+                if (s->count == s->capacity) {
+                    s->capacity = s->capacity == 0 ? 1024 : s->capacity * 2;
+                    s->latency = realloc(s->latency, s->capacity * sizeof(double));
+                }
+                s->latency[s->count++] = work[i].s.latency[j];
+            }
+            free(work[i].s.latency);
+        }
+        if (failed || umount_fs(volume) == ERR) return ERR;
+
+        qsort(s->latency, s->count, sizeof(double), compareLatency);
+        printf("{\"bench\": \"threads_rw_small\", \"block_size\": %d, \"files\": %d, \"threads\": %d, \"ops\": %d, "
+               "\"seconds\": %.6f, \"ops_per_sec\": %.1f, \"p50_us\": %.2f, \"p99_us\": %.2f}\n",
+               blockSize, files, threads, s->count, seconds, seconds > 0 ? s->count / seconds : 0,
+               percentile(s, 0.50), percentile(s, 0.99));
+        fflush(stdout);
+        s->count = 0;
+    }
+    return SUC;
+}
+
+//times making a block-sized write durable, the close of a writer is what syncs the volume
+int benchSync(int blockSize, int files, samples *s) {
+    fileSystem *volume = freshVolume(blockSize, files, MOUNT_BUFFERED | DURABLE_FSYNC);
+    if (volume == NULL) return ERR;
+    int fd = fs_create(volume, "synced");
+    fs_close(volume, fd);
+    for (int i = 0; i < BENCH_SYNCS; i++) {
+        fd = fs_open(volume, "synced", O_WRONLY);
+        if (fs_write(volume, fd, buffer, blockSize) != blockSize) return ERR;
+        double start = now_us();
+        if (fs_close(volume, fd) == ERR) return ERR;
+        record(s, start);
+    }
+    report("sync", blockSize, files, s, (double) BENCH_SYNCS * blockSize);
+    return umount_fs(volume);
+}
+
+/*
+ * runs every benchmark for each geometry of the sweep and prints a line of JSON per result
+ * the image is made in the working directory and removed at the end
+ */
+int main() {
+    for (size_t i = 0; i < sizeof(buffer); i++) buffer[i] = (char) i;
+    samples s = {0};
+    int res = SUC;
+    for (size_t b = 0; b < sizeof(blockSizes) / sizeof(int) && res == SUC; b++) {
+        for (size_t f = 0; f < sizeof(fileCounts) / sizeof(int) && res == SUC; f++) {
+            int blockSize = blockSizes[b], files = fileCounts[f];
+            if (benchMount(blockSize, files, &s) == ERR || benchCreate(blockSize, files, &s) == ERR ||
+                benchData(blockSize, files, &s) == ERR || benchSync(blockSize, files, &s) == ERR ||
+                benchThreads(blockSize, files, &s) == ERR) {
+                fprintf(stderr, "benchmark failed at block size %d with %d files\n", blockSize, files);
+                res = ERR;
+            }
+        }
+    }
+    free(s.latency);
+    unlink(BENCH_IMAGE);
+    return res == SUC ? 0 : 1;
+}
@@ -1,68 +1,319 @@
 #include "constructors.h"
 
-//constructor for a new file
-file *new_file(char *name, int16_t id, int16_t size){
-    file *this = calloc(1, FILE_ENTRY_SIZE);
-    strcpy(this->name, name);
+//copies a name into an entry's name field, names longer than the field are cut to fit
+void set_name(char *to, const char *name) {
+    size_t length = strnlen(name, FILE_NAME_SIZE);
+    memcpy(to, name, length);
+    memset(to + length, 0, FILE_NAME_SIZE - length);
+}
+
+//sets up a file struct
+void set_file(file *this, char *name, int32_t id, int64_t size){
+    memset(this, 0, sizeof(file));
+    set_name(this->name, name);  //a full length name has no terminator
     this->size = size;  //maybe find instead of add
     this->fatIndex = id;//maybe find instead of add
-
-    return this;
+    this->tailIndex = id;   //a new chain is a single block with nothing in it
+    this->tailUsed = 0;
 }
 
-//constructor for a new block
-block *new_block(char *data) {
-    block *this = calloc(1, BLOCK_SIZE);
+//constructor for an empty slab pool, its first chunk is allocated by the first object taken from it
+slabPool *new_slabPool(size_t objectSize) {
+    slabPool *this = calloc(1, sizeof(slabPool));
     if(this == NULL) return NULL;
-    strcpy(this->data, data);
+    this->objectSize = (objectSize + SLAB_ALIGN - 1) / SLAB_ALIGN * SLAB_ALIGN;
 
     return this;
 }
 
+/*
+ * takes an object from the pool, the most recently freed one if there is one
+ * otherwise the next unused object of the newest chunk, allocating a chunk when that one is used up
+ * the object is zeroed like a calloc'd one
+ */
+void *slab_alloc(slabPool *pool) {
+    void *object = pool->freeList;
+    if(object != NULL) {
+        pool->freeList = *(void **) object;
+    } else {
+        if(pool->next == pool->end) {
+            char *chunk = malloc(SLAB_ALIGN + SLAB_CHUNK_OBJECTS * pool->objectSize);
+            if(chunk == NULL) return NULL;
+            *(void **) chunk = pool->chunks;    //the chunk's header links it to the one before
+            pool->chunks = chunk;
+            pool->next = chunk + SLAB_ALIGN;
+            pool->end = pool->next + SLAB_CHUNK_OBJECTS * pool->objectSize;
+        }
+        object = pool->next;
+        pool->next += pool->objectSize;
+    }
+    pool->live++;
+    memset(object, 0, pool->objectSize);
+
+    return object;
+}
+
+//puts an object back on the pool's free list, its memory is released with the pool
+void slab_free(slabPool *pool, void *object) {
+    if(object == NULL) return;
+    *(void **) object = pool->freeList;
+    pool->freeList = object;
+    pool->live--;
+}
+
 //constructor for a new file descriptor
-descriptor *new_descriptor(file *reps, int mode, int fp) {
-    descriptor *this = calloc(1, sizeof(descriptor));    //no mandatory fixed size
+descriptor *new_descriptor(slabPool *pool, file *reps, dentry *node, int mode, off_t fp) {
+    descriptor *this = slab_alloc(pool);
     if(this == NULL) return NULL;
     this->represents = reps;
+    this->node = node;
     this->mode = mode;
     this->fp = fp;
+    this->reserveStart = -1;
+    this->reserveCount = 0;
+    pthread_mutex_init(&this->posLock, NULL);
+    pthread_mutex_init(&this->mapLock, NULL);
+
+    return this;
+}
+
+//constructor for a dentry, it starts with no children and no open descriptors
+dentry *new_dentry(slabPool *pool, const char *name, dentry *parent, int slot, file *entry, char owned) {
+    dentry *this = slab_alloc(pool);
+    if(this == NULL) return NULL;
+    strncpy(this->name, name, FILE_NAME_SIZE);
+    this->parent = parent;
+    this->slot = slot;
+    this->owned = owned;
+    if(owned) {
+        this->copy = *entry;
+        this->entry = &this->copy;
+    } else {
+        this->entry = entry;
+    }
+    pthread_rwlock_init(&this->lock, NULL);
+
+    return this;
+}
+
+/*
+ * constructor for the entries of a subdirectory, every slot starts empty
+ * the block list starts empty and is filled as the directory's chain is walked
+ */
+subDirectory *new_subDirectory(int slots) {
+    subDirectory *this = calloc(1, sizeof(subDirectory));
+    if(this == NULL) return NULL;
+    this->capacity = SUBDIR_MIN_SLOTS;
+    while(this->capacity < slots) this->capacity *= 2;
+    this->blockCapacity = SUBDIR_MIN_SLOTS;
+    this->files = calloc(this->capacity, sizeof(file *));
+    this->entries = calloc(this->capacity, sizeof(file));
+    this->freeSlots = calloc(this->capacity, sizeof(int));
+    this->index = new_nameIndex(this->capacity);
+    this->blocks = calloc(this->blockCapacity, sizeof(int));
+    if(this->files == NULL || this->entries == NULL || this->freeSlots == NULL || this->index == NULL || this->blocks == NULL) {
+        free_subDirectory(this);
+        return NULL;
+    }
+
+    for(int i = 0; i < this->capacity; i++) {
+        this->files[i] = &this->entries[i];
+    }
+
+    return this;
+}
+
+//constructor for an empty dentry cache
+dentryCache *new_dentryCache(int buckets) {
+    dentryCache *this = calloc(1, sizeof(dentryCache));
+    if(this == NULL) return NULL;
+    this->buckets = calloc(buckets, sizeof(dentry *));
+    if(this->buckets == NULL) {
+        free(this);
+        return NULL;
+    }
+    this->capacity = buckets;
+    this->count = 0;
+
+    return this;
+}
+
+//constructor for an empty descriptor table, its first chunk of slots is allocated by the first open
+descriptorTable *new_descriptorTable() {
+    descriptorTable *this = calloc(1, sizeof(descriptorTable));
+    if(this == NULL) return NULL;
+    this->freeHead = -1;
+
+    return this;
+}
+
+//constructor for a dirty set, every unit starts clean
+dirtySet *new_dirtySet(int units) {
+    dirtySet *this = calloc(1, sizeof(dirtySet));
+    if(this == NULL) return NULL;
+    this->flags = calloc(units, sizeof(char));
+    this->list = calloc(units, sizeof(int));
+    if(this->flags == NULL || this->list == NULL) {
+        free_dirtySet(this);
+        return NULL;
+    }
+    this->count = 0;
+    this->units = units;
 
     return this;
 }
 
-//constructor for the volume boot record
-volumeBootRecord *new_VBR() {
-    volumeBootRecord *this = calloc(1, VOLUME_RECORD_SIZE);
+//constructor for a free-block bitmap, every index starts full until the FAT is scanned
+freeMap *new_freeMap(int entries) {
+    freeMap *this = calloc(1, sizeof(freeMap));
+    if(this == NULL) return NULL;
+    this->wordCount = (entries + MAP_WORD_BITS - 1) / MAP_WORD_BITS;
+    this->summaryCount = (this->wordCount + MAP_WORD_BITS - 1) / MAP_WORD_BITS;
+    this->words = calloc(this->wordCount, sizeof(uint64_t));
+    this->summary = calloc(this->summaryCount, sizeof(uint64_t));
+    if(this->words == NULL || this->summary == NULL) {
+        free_freeMap(this);
+        return NULL;
+    }
+
+    return this;
+}
+
+//constructor for an empty name index, at least twice as many slots as entries keeps probes short
+nameIndex *new_nameIndex(int entries) {
+    nameIndex *this = calloc(1, sizeof(nameIndex));
+    if(this == NULL) return NULL;
+    this->capacity = NAME_INDEX_MIN_SLOTS;
+    while(this->capacity < entries * 2) this->capacity *= 2;
+    this->slots = malloc(this->capacity * sizeof(int));
+    if(this->slots == NULL) {
+        free_nameIndex(this);
+        return NULL;
+    }
+    for(int i = 0; i < this->capacity; i++) this->slots[i] = -1;
+
+    return this;
+}
+
+//constructor for an image build with no entries listed yet
+imageBuild *new_imageBuild() {
+    imageBuild *this = calloc(1, sizeof(imageBuild));
+    if(this == NULL) return NULL;
+    this->imageFd = -1;
+    pthread_mutex_init(&this->lock, NULL);
+
+    return this;
+}
+
+//constructor for the volume boot record of an image with the given geometry
+volumeBootRecord *new_VBR(int blockSize, int blockCount, int maxFiles, int fatWidth) {
+    volumeBootRecord *this = calloc(1, sizeof(volumeBootRecord));
     if(this == NULL) return NULL;
     this->fsId = IDENT;
-    this->blockSize = BLOCK_SIZE;
-    this->maxFiles = MAX_ENTRIES;
+    this->blockSize = blockSize;
+    this->maxFiles = maxFiles;
+    this->blockCount = blockCount;
+    this->fatWidth = fatWidth;
 
     return this;
 }
 
-//constructor for the FAT
-fatTable *new_FAT() {
-    fatTable *this = calloc(1, FAT_TABLE_SIZE);
+//number of dirty flags needed to cover a FAT of the given number and width of entries
+static int fatDirtyUnits(int entries, int width) {
+    size_t bytes = (size_t) entries * (width / 8);
+    return (bytes + FAT_SYNC_CHUNK - 1) / FAT_SYNC_CHUNK;
+}
+
+/*
+ * constructor for the FAT
+ * index 0 is reserved as it would read as the end of a FAT-8 chain, and in a FAT-8 table
+ * so is the index whose number is the free marker
+ * a zeroed FAT-32 table is already free so only the reserved indexes are set
+ */
+fatTable *new_FAT(int entries, int width) {
+    fatTable *this = calloc(1, sizeof(fatTable));
+    if(this == NULL) return NULL;
+    this->table = calloc(entries, width / 8);
+    if(this->table == NULL) {
+        free(this);
+        return NULL;
+    }
+    this->entries = entries;
+    this->width = width;
 
     //set up the values of an empty fat table
-    this->table[0] = '\0'; //the number 0 represents the reserved block (0 != '0)
-    for(int i = FIRST_FAT_INDEX; i <= LAST_FAT_INDEX; i++) {
-        this->table[i] = '0';   //character '0' represents a free space
+    this->storing = 0;  //keeps track of the number of full indexes
+    if(width == FAT_WIDTH_32) {
+        uint32_t *fat = this->table;
+        for(int i = 0; i < FIRST_FAT_INDEX; i++) fat[i] = FAT_RESERVED;
+        this->storing = FIRST_FAT_INDEX;
+    } else {
+        u_char *fat = this->table;
+        for(int i = 0; i < entries; i++) {
+            if(i < FIRST_FAT_INDEX || i == FAT8_FREE) {
+                fat[i] = FAT8_RESERVED;
+                this->storing++;
+            }
+            else fat[i] = FAT8_FREE;   //character '0' represents a free space
+        }
     }
     this->nextFreeSlot = -1; // cannot be sure if a loaded FAT has free space or not, start at error and update when loading
-    this->storing = 0;  //keeps track of the number of full indexes
+    this->mapped = FALSE;
+    this->dirty = new_dirtySet(fatDirtyUnits(entries, width));
+    this->free = new_freeMap(entries);
+    if(this->dirty == NULL || this->free == NULL) {
+        free_FAT(this);
+        return NULL;
+    }
+
+    return this;
+}
+
+/*
+ * constructor for a FAT whose table lives in a mapped image
+ * the table is not initialised as it already holds the on disk values
+ */
+fatTable *new_FAT_view(void *view, int entries, int width) {
+    fatTable *this = calloc(1, sizeof(fatTable));
+    if(this == NULL) return NULL;
+    this->table = view;
+    this->entries = entries;
+    this->width = width;
+    this->nextFreeSlot = -1;    //updated when the view is scanned at mount
+    this->storing = 0;
+    this->mapped = TRUE;
+    this->dirty = new_dirtySet(fatDirtyUnits(entries, width));
+    this->free = new_freeMap(entries);
+    if(this->dirty == NULL || this->free == NULL) {
+        free_FAT(this);
+        return NULL;
+    }
 
     return this;
 }
 
-//constructor for the root Dir
-rootDirectory *new_rootDir() {
-    rootDirectory *this = calloc(1, DIRECTORY_SIZE);
+/*
+ * constructor for the root Dir
+ * the entries are laid out in one allocation as they are on disk, rather than one allocation each
+ */
+rootDirectory *new_rootDir(int capacity) {
+    rootDirectory *this = calloc(1, sizeof(rootDirectory));
+    if(this == NULL) return NULL;
+    this->capacity = capacity;
+    this->mapped = FALSE;
+    this->files = calloc(capacity, sizeof(file *));
+    this->entries = malloc((size_t) capacity * FILE_ENTRY_SIZE);
+    this->dirty = new_dirtySet(capacity);
+    this->index = new_nameIndex(capacity);
+    if(this->files == NULL || this->entries == NULL || this->dirty == NULL || this->index == NULL) {
+        free_rootDirectory(this);
+        return NULL;
+    }
 
     // for each entry in the directory initialise an empty file struct
-    for(int i = 0; i < MAX_ENTRIES; i++) {
-        this->files[i] = new_file("", -1, -1);  //array of pointers, only data is written to disk fle
+    for(int i = 0; i < capacity; i++) {
+        this->files[i] = (file *) (this->entries + (i * FILE_ENTRY_SIZE));  //array of pointers, only data is written to disk fle
+        set_file(this->files[i], "", -1, -1);
     }
     this->storing = 0;
     this->nextFreeSlot = -1; // cannot be sure if a loaded dir has free space or not, start at error and update when loading
@@ -70,13 +321,74 @@ rootDirectory *new_rootDir() {
     return this;
 }
 
-//constructor for the data region
-dataRegion *new_dataRegion() {
-    dataRegion *this = calloc(1, DATA_REGION_SIZE);
+/*
+ * constructor for a root Dir whose entries live in a mapped image
+ * the on disk entry layout matches the file struct so each entry is used in place
+ */
+rootDirectory *new_rootDir_view(char *view, int capacity) {
+    rootDirectory *this = calloc(1, sizeof(rootDirectory));
+    if(this == NULL) return NULL;
+    this->capacity = capacity;
+    this->mapped = TRUE;
+    this->files = calloc(capacity, sizeof(file *));
+    this->dirty = new_dirtySet(capacity);
+    this->index = new_nameIndex(capacity);
+    if(this->files == NULL || this->dirty == NULL || this->index == NULL) {
+        free_rootDirectory(this);
+        return NULL;
+    }
+
+    for(int i = 0; i < capacity; i++) {
+        this->files[i] = (file *) (view + (i * FILE_ENTRY_SIZE));
+    }
+    this->storing = 0;
+    this->nextFreeSlot = -1;    //updated when the view is scanned at mount
+
+    return this;
+}
+
+/*
+ * constructor for the data region
+ * the blocks are laid out in one zeroed allocation as they are on disk, rather than one allocation each
+ */
+dataRegion *new_dataRegion(int count, int blockSize) {
+    dataRegion *this = calloc(1, sizeof(dataRegion));
+    if(this == NULL) return NULL;
+    this->count = count;
+    this->blockSize = blockSize;
+    this->mapped = FALSE;
+    this->blocks = calloc(count, sizeof(block *));
+    this->data = calloc(count, blockSize);
+    this->dirty = new_dirtySet(count);
+    if(this->blocks == NULL || this->data == NULL || this->dirty == NULL) {
+        free_dataRegion(this);
+        return NULL;
+    }
 
     //for each block in the data block region   (one block per FAT index)
-    for(int i = 0; i < FAT_TABLE_SIZE; i++) {
-        this->blocks[i] = new_block(""); //array of pointers only data is written to disk file
+    for(int i = 0; i < count; i++) {
+        this->blocks[i] = (block *) (this->data + ((size_t) i * blockSize)); //array of pointers only data is written to disk file
+    }
+
+    return this;
+}
+
+//constructor for a data region whose blocks live in a mapped image
+dataRegion *new_dataRegion_view(char *view, int count, int blockSize) {
+    dataRegion *this = calloc(1, sizeof(dataRegion));
+    if(this == NULL) return NULL;
+    this->count = count;
+    this->blockSize = blockSize;
+    this->mapped = TRUE;
+    this->blocks = calloc(count, sizeof(block *));
+    this->dirty = new_dirtySet(count);
+    if(this->blocks == NULL || this->dirty == NULL) {
+        free_dataRegion(this);
+        return NULL;
+    }
+
+    for(int i = 0; i < count; i++) {
+        this->blocks[i] = (block *) (view + ((size_t) i * blockSize));
     }
 
     return this;
@@ -84,34 +396,144 @@ dataRegion *new_dataRegion() {
 
 //constructor for the file system
 fileSystem *new_fileSystem(volumeBootRecord *vBoot, fatTable *fat, rootDirectory *dir, dataRegion *blocks) {
-    fileSystem *this = calloc(1, FILE_SYSTEM_SIZE);
+    fileSystem *this = calloc(1, sizeof(fileSystem));
+    if(this == NULL) return NULL;
     this->vmb = vBoot;
     this->table = fat;
     this->dir = dir;
     this->storage = blocks;
+    this->descriptorPool = new_slabPool(sizeof(descriptor));
+    this->dentryPool = new_slabPool(sizeof(dentry));
+    if(this->descriptorPool == NULL || this->dentryPool == NULL) {
+        free_slabPool(this->descriptorPool);
+        free_slabPool(this->dentryPool);
+        free(this);
+        return NULL;
+    }
+    this->filedes = -1;
+    this->durability = DURABLE_FSYNC;
+    this->commitWindow = GROUP_COMMIT_USECS;
+    pthread_mutex_init(&this->commitLock, NULL);
+    pthread_cond_init(&this->commitWake, NULL);
+    pthread_cond_init(&this->commitDone, NULL);
+    pthread_rwlock_init(&this->volumeLock, NULL);
+    //a sync waiting for the data lock is let in before new writers so a steady stream of writes cannot starve it
+    pthread_rwlockattr_t preferSync;
+    pthread_rwlockattr_init(&preferSync);
+#ifdef __linux__
+    pthread_rwlockattr_setkind_np(&preferSync, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    pthread_rwlock_init(&this->dataLock, &preferSync);
+    pthread_rwlockattr_destroy(&preferSync);
+    pthread_mutex_init(&this->metaLock, NULL);
+    pthread_mutex_init(&this->pinLock, NULL);
+    pthread_cond_init(&this->unpinned, NULL);
+    pthread_mutex_init(&this->fdLock, NULL);
+    pthread_cond_init(&this->fdIdle, NULL);
 
     return this;
 }
 
 // ----------freeing methods----------
 
-//frees the memory allocated to the given file struct
-void free_file(file *toFree) {
+//frees every chunk of the given slab pool at once, along with any objects still taken from it
+void free_slabPool(slabPool *toFree) {
+    if (toFree == NULL) return;
+    void *chunk = toFree->chunks;
+    while (chunk != NULL) {
+        void *before = *(void **) chunk;
+        free(chunk);
+        chunk = before;
+    }
+    free(toFree);
+    toFree = NULL;
+}
+
+/*
+ * returns the given file descriptor struct to its pool and frees its block map
+ * doesn't free the internal file as it will be freed with the directory
+*/
+void free_descriptor(slabPool *pool, descriptor *toFree) {
+    if (toFree == NULL) return;
+    pthread_mutex_destroy(&toFree->posLock);
+    pthread_mutex_destroy(&toFree->mapLock);
+    free(toFree->blockMap);
+    slab_free(pool, toFree);
+    toFree = NULL;
+}
+
+//frees the memory allocated to the given subdirectory entries, their name index and block list
+void free_subDirectory(subDirectory *toFree) {
+    if (toFree == NULL) return;
+    free(toFree->files);
+    free(toFree->entries);
+    free(toFree->freeSlots);
+    free_nameIndex(toFree->index);
+    free(toFree->blocks);
     free(toFree);
     toFree = NULL;
 }
 
-//frees the memory allocated to the given block struct
-void free_block(block *toFree) {
+//returns the given dentry, and with it any entry or subdirectory entries it owns, to its pool
+void free_dentry(slabPool *pool, dentry *toFree) {
+    if (toFree == NULL) return;
+    free_subDirectory(toFree->sub);
+    pthread_rwlock_destroy(&toFree->lock);
+    slab_free(pool, toFree);
+    toFree = NULL;
+}
+
+//frees the memory allocated to the given dentry cache and returns every dentry in it to the pool
+void free_dentryCache(slabPool *pool, dentryCache *toFree) {
+    if (toFree == NULL) return;
+    for (int i = 0; i < toFree->capacity; i++) {
+        dentry *current = toFree->buckets[i];
+        while (current != NULL) {
+            dentry *next = current->hashNext;
+            free_dentry(pool, current);
+            current = next;
+        }
+    }
+    free(toFree->buckets);
     free(toFree);
     toFree = NULL;
 }
 
-/*
- * frees the memory allocated to the given file descriptor struct
- * doesn't free the internal file as it will be freed with the directory
-*/
-void free_descriptor(descriptor *toFree) {
+//frees the memory allocated to the given descriptor table and returns every descriptor still in it to the pool
+void free_descriptorTable(slabPool *pool, descriptorTable *toFree) {
+    if (toFree == NULL) return;
+    for (int i = 0; i < toFree->slots; i++) {
+        free_descriptor(pool, toFree->chunks[i / FD_CHUNK_SLOTS][i % FD_CHUNK_SLOTS].desc);
+    }
+    for (int i = 0; i < MAX_OPEN_FILES / FD_CHUNK_SLOTS && toFree->chunks[i] != NULL; i++) {
+        free(toFree->chunks[i]);
+    }
+    free(toFree);
+    toFree = NULL;
+}
+
+//frees the memory allocated to the given dirty set and its arrays
+void free_dirtySet(dirtySet *toFree) {
+    if(toFree == NULL) return;
+    free(toFree->flags);
+    free(toFree->list);
+    free(toFree);
+    toFree = NULL;
+}
+
+//frees the memory allocated to the given free-block bitmap and its summary
+void free_freeMap(freeMap *toFree) {
+    if (toFree == NULL) return;
+    free(toFree->words);
+    free(toFree->summary);
+    free(toFree);
+    toFree = NULL;
+}
+
+//frees the memory allocated to the given name index and its slots
+void free_nameIndex(nameIndex *toFree) {
+    if (toFree == NULL) return;
+    free(toFree->slots);
     free(toFree);
     toFree = NULL;
 }
@@ -122,34 +544,41 @@ void free_VBR(volumeBootRecord *toFree) {
     toFree = NULL;
 }
 
-//frees the memory allocated to the given File Allocation Table
+//frees the memory allocated to the given File Allocation Table (a mapped table belongs to the image)
 void free_FAT(fatTable *toFree) {
+    if (toFree == NULL) return;
+    if(!toFree->mapped) free(toFree->table);
+    free_dirtySet(toFree->dirty);
+    free_freeMap(toFree->free);
     free(toFree);
     toFree = NULL;
 }
 
 /*
  * frees the memory allocated to the given rootDirectory
- * first frees all of the directory's files
+ * first frees the directory's files (unless they are views into a mapped image)
  * then frees the directory itself
  */
 void free_rootDirectory(rootDirectory *toFree) {
-    for(int i = 0; i < MAX_ENTRIES; i++) {
-        free(toFree->files[i]);
-    }
+    if (toFree == NULL) return;
+    free(toFree->entries);
+    free(toFree->files);
+    free_dirtySet(toFree->dirty);
+    free_nameIndex(toFree->index);
     free(toFree);
     toFree = NULL;
 }
 
 /*
  * frees the memory allocated to the given data region
- * first frees all of the blocks
+ * first frees the blocks (unless they are views into a mapped image)
  * then frees the data region itself
  */
 void free_dataRegion(dataRegion *toFree) {
-    for(int i = 0; i < FAT_TABLE_SIZE; i++) {
-        free(toFree->blocks[i]);
-    }
+    if (toFree == NULL) return;
+    free(toFree->data);
+    free(toFree->blocks);
+    free_dirtySet(toFree->dirty);
     free(toFree);
     toFree = NULL;
 }
@@ -160,9 +589,12 @@ void free_dataRegion(dataRegion *toFree) {
  * then the FAT
  * then the directory
  * then the data region
+ * then the descriptor table and dentry cache
+ * then, all at once, the pools their objects came from
  * then the file system itself
  */
 void free_fileSystem(fileSystem *toFree) {
+    if (toFree == NULL) return;
     free_VBR(toFree->vmb);
     toFree->vmb = NULL;
 
@@ -175,6 +607,35 @@ void free_fileSystem(fileSystem *toFree) {
     free_dataRegion(toFree->storage);
     toFree->storage = NULL;
 
+    free_descriptorTable(toFree->descriptorPool, toFree->fds);
+    free_dentryCache(toFree->dentryPool, toFree->dcache);
+    free_dentry(toFree->dentryPool, toFree->rootNode);
+    free_slabPool(toFree->descriptorPool);
+    free_slabPool(toFree->dentryPool);
+
+    pthread_mutex_destroy(&toFree->commitLock);
+    pthread_cond_destroy(&toFree->commitWake);
+    pthread_cond_destroy(&toFree->commitDone);
+    pthread_rwlock_destroy(&toFree->volumeLock);
+    pthread_rwlock_destroy(&toFree->dataLock);
+    pthread_mutex_destroy(&toFree->metaLock);
+    pthread_mutex_destroy(&toFree->pinLock);
+    pthread_cond_destroy(&toFree->unpinned);
+    pthread_mutex_destroy(&toFree->fdLock);
+    pthread_cond_destroy(&toFree->fdIdle);
+    free(toFree);
+    toFree = NULL;
+}
+
+//frees the memory allocated to the given image build and each of its entries
+void free_imageBuild(imageBuild *toFree) {
+    if (toFree == NULL) return;
+    for (int i = 0; i < toFree->count; i++) {
+        free(toFree->entries[i].hostPath);
+        free(toFree->entries[i].content);
+    }
+    free(toFree->entries);
+    pthread_mutex_destroy(&toFree->lock);
     free(toFree);
     toFree = NULL;
 }
@@ -4,27 +4,192 @@
 #include "fs.h"
 #include <errno.h>
 #include <string.h>
+#include <dirent.h>
 
 //----------type definitions----------
 
-//struct to define the files stored in the root directory
+//struct to define the files stored in a directory
+//its layout matches a directory entry on disk so a mapped directory's entries are used in place
 typedef struct file {
     char name[FILE_NAME_SIZE];
-    int16_t fatIndex;
-    int16_t size;
+    int32_t fatIndex;
+    int32_t type;   //FILE_TYPE_REGULAR or FILE_TYPE_DIRECTORY
+    int64_t size;   //bytes held, for a directory the bytes of entry slots it has used
+    int32_t tailIndex;  //FAT index of the last block of the chain, where appends land
+    int32_t tailUsed;   //bytes of that block in use, 0 only while the file is empty
 }file;
 
-//struct to define a block of data
+//struct to define a block of data, data really runs for the block size held in the volume boot record
 typedef struct block {
-    char data[BLOCK_SIZE];
+    char data[1];
 }block;
 
+/*
+ * struct for a cached directory entry, used to resolve paths without re-reading each directory
+ * every open file has one and it holds the file's record in the open-file table
+ */
+typedef struct dentry {
+    char name[FILE_NAME_SIZE + 1];  //terminated copy of the entry's name
+    struct dentry *parent;  //directory holding the entry, NULL for the root
+    struct dentry *hashNext;    //next dentry in the same cache bucket
+    file *entry;    //root entries point into the root directory, the rest point at their own copy
+    file copy;  //the copy of the entry when it is owned
+    char owned; //TRUE when entry is the dentry's copy
+    int slot;   //index of the entry in its parent directory
+    int children;   //number of cached dentries whose parent this is
+    int descriptors;    //number of descriptors open on the file
+    char writing;   //TRUE while one of them is open for writing
+    int pins;   //number of read views of the file not yet released, guarded by the volume's pin lock
+    struct subDirectory *sub;   //entries of a subdirectory once it has been looked in, NULL until then and for files
+    pthread_rwlock_t lock;  //held shared while the file's data is read and exclusively while it is written
+}dentry;
+
+//struct for the cache of dentries, hashed on parent and name
+typedef struct dentryCache {
+    dentry **buckets;
+    int capacity;   //number of buckets, always a power of two
+    int count;  //number of cached dentries
+}dentryCache;
+
 typedef struct descriptor {
     file *represents;
+    dentry *node;   //cached entry of the file, keys the open-file table
     int mode;
     off_t fp; //offset for where in the set of data blocks it is, updated whenever read/write are used or the file is cleared
+    int reserveStart;   //first block of the extent held free for the file to grow into
+    int reserveCount;   //number of blocks left in that extent, 0 when nothing is held
+    int *blockMap;  //FAT index of each block of the file in chain order, filled in as far as it has been needed
+    int mapLength;  //number of blocks in the map
+    int mapCapacity;    //number of blocks the map has room for
+    pthread_mutex_t posLock;    //held while a call reads and moves fp
+    pthread_mutex_t mapLock;    //held while the block map is read or extended
+    int views;  //number of read views taken through the descriptor and not yet released, guarded by the pin lock
+    int slot;   //slot of the descriptor table holding it
 }descriptor;
 
+/*
+ * struct for a pool of equally sized objects carved out of larger chunks
+ * freed objects go on a free list for the next allocation and the chunks are only released
+ * all at once, when the pool is freed with its volume
+ */
+typedef struct slabPool {
+    size_t objectSize;  //bytes per object, rounded up to SLAB_ALIGN
+    void *chunks;   //chunks allocated so far, each starts with a pointer to the one before
+    char *next; //next never used object of the newest chunk
+    char *end;  //end of the newest chunk
+    void *freeList; //freed objects, each starts with a pointer to the next
+    int live;   //objects handed out and not yet freed
+}slabPool;
+
+/*
+ * struct for a slot of the descriptor table
+ * desc, generation and closing are only changed under the volume's fd lock, but calls taking the descriptor
+ * read them and count themselves in refs with atomics so they never take the lock (see desc_take)
+ */
+typedef struct fdSlot {
+    descriptor *desc;   //NULL while the slot is free
+    int nextFree;   //while free, the next slot of the free list (-1 ends it)
+    uint32_t generation;    //bumped each time the slot is freed so fds naming an earlier descriptor are caught
+    int refs;   //number of calls using the slot's descriptor, or checking whether they may
+    char closing;   //TRUE once a close has begun, no further call can take the descriptor
+}fdSlot;
+
+/*
+ * struct for the table of a volume's open descriptors
+ * slots are allocated a chunk at a time as more are needed and never move, so a lookup is two array reads
+ * closed slots go on a free list that open takes from before growing the table
+ */
+typedef struct descriptorTable {
+    fdSlot *chunks[MAX_OPEN_FILES / FD_CHUNK_SLOTS];    //NULL past the chunks allocated so far
+    int slots;  //number of slots handed out so far
+    int freeHead;   //first free slot, -1 when every slot handed out is in use
+    int open;   //number of open descriptors
+}descriptorTable;
+
+//struct to track which units (FAT chunks, directory entries or blocks) of a region changed since the last sync
+typedef struct dirtySet {
+    char *flags;    //one flag per unit, TRUE when the unit is already listed
+    int *list;  //the changed units in the order they were first changed
+    int count;  //number of units in the list
+    int units;  //number of units in the region
+}dirtySet;
+
+/*
+ * struct for the free-block bitmap kept alongside the FAT, one bit per index set while it is free
+ * each bit of the summary is set while the matching word of the bitmap has a free bit
+ */
+typedef struct freeMap {
+    uint64_t *words;
+    uint64_t *summary;
+    int wordCount;
+    int summaryCount;
+}freeMap;
+
+/*
+ * struct for the hash index over the names in the directory
+ * open addressing with linear probing, each slot holds a directory index or -1 when empty
+ */
+typedef struct nameIndex {
+    int *slots;
+    int capacity;   //always a power of two
+}nameIndex;
+
+//struct for a file or directory of a host tree being copied into a new image by make_fs_from
+typedef struct buildEntry {
+    char *hostPath; //where the source is on the host
+    char name[FILE_NAME_SIZE + 1];
+    int type;   //FILE_TYPE_REGULAR or FILE_TYPE_DIRECTORY
+    int64_t size;   //bytes the entry holds, for a directory the bytes of its entries
+    int parent; //index of the directory holding it in the build, -1 for the root directory
+    int slot;   //slot of the entry in that directory
+    int first;  //FAT index of its first block
+    char *content;  //entries of a directory, serialized as they are written to its blocks
+}buildEntry;
+
+/*
+ * struct for an image being built from a host tree
+ * the entries are listed parent first, then the worker threads take them in turn to copy into the image
+ */
+typedef struct imageBuild {
+    buildEntry *entries;
+    int count;
+    int capacity;
+    int next;   //next entry a worker takes
+    int failed; //TRUE once any entry could not be copied
+    pthread_mutex_t lock;   //guards next and failed
+
+    //what the workers need of the image, they are not given the volume being built
+    int imageFd;
+    int blockSize;
+    off_t dataOffset;
+    char narrowFat; //TRUE for a FAT-8 image, where the index read as free is skipped
+}imageBuild;
+
+//struct for a sync whose changes are written to the image but not yet made durable (see sync_write and sync_flush)
+typedef struct pendingSync {
+    char written;   //TRUE from the write until the flush
+    uint64_t start; //when the sync started, its latency runs until the flush is done
+}pendingSync;
+
+/*
+ * struct for the blocks a write call links on to its file and the blocks it changes
+ * both are handled WRITE_BATCH_BLOCKS at a time so a call takes the metadata lock once per batch rather than once per block
+ */
+typedef struct writeBatch {
+    int linked[WRITE_BATCH_BLOCKS]; //blocks linked after the file's tail for the call to fill, in chain order
+    int linkedCount;
+    int linkedNext; //next of them to become the tail
+    int dirty[WRITE_BATCH_BLOCKS];  //blocks changed and not yet marked dirty
+    int dirtyCount;
+}writeBatch;
+
+//struct for the counters of one thread, every thread's are listed so fs_stats can sum them
+typedef struct statsBlock {
+    fsStats counts; //only written by the thread they belong to
+    struct statsBlock *next;
+    struct statsBlock *prev;
+}statsBlock;
+
 //----------Section Structs----------
 
 // a struct to define the structure of the volume boot record of the fs
@@ -32,72 +197,206 @@ typedef struct volumeBootRecord {
     int32_t fsId;
     int32_t blockSize;
     int32_t maxFiles;
+    int32_t blockCount;
+    int32_t fatWidth;   //bits per FAT index, FAT_WIDTH_8 or FAT_WIDTH_32
 }volumeBootRecord;
 
+//struct describing where each region of an image lives, derived from its volume boot record
+typedef struct regionLayout {
+    off_t dirOffset;    //offset from start of file to root directory
+    off_t dataOffset;   //offset from start of file to data region
+    size_t fatSize; //size in bytes of the FAT
+    size_t dirSize; //size in bytes of the root directory
+    size_t dataSize;    //size in bytes of the data region
+    size_t imageSize;   //size in bytes of the whole image
+}regionLayout;
+
 //a struct to define the structure of the File Allocation Table
 typedef struct fatTable {
-    u_char table[FAT_TABLE_SIZE]; //char is a single byte
+    void *table; //indexes of width bits, points to either a heap buffer or the mapped image
+    int entries;    //number of indexes in the table (one per block)
+    int width;  //bits per index, FAT_WIDTH_8 or FAT_WIDTH_32
     int nextFreeSlot; //used to keep track of where the next free index is
     int storing;
+    char mapped; //TRUE when the table is a view into the mapped image (not owned by the struct)
+    dirtySet *dirty;    //FAT chunks changed since the last sync
+    freeMap *free;  //which indexes are free, rebuilt at mount and kept in step by every FAT change
 }fatTable;
 
 //struct to define the structure of the root directory
 typedef struct rootDirectory {
-    file *files[MAX_ENTRIES];
+    file **files;
+    char *entries;  //memory holding every entry when the directory is buffered, NULL when mapped
+    int capacity;   //number of entries the directory can hold
     int storing; //used for a quick capacity check;
     int nextFreeSlot; //used to keep track of where the next free slot is in the directory
+    char mapped; //TRUE when the file entries are views into the mapped image (not owned by the struct)
+    dirtySet *dirty;    //entries changed since the last sync
+    nameIndex *index;   //finds an entry by name, rebuilt at mount and kept in step by every entry change
 }rootDirectory;
 
+/*
+ * struct for the entries of a subdirectory, read from its blocks the first time it is looked in
+ * and kept with its dentry so later lookups and changes do not walk the directory again
+ * every change is written through to the blocks as it is made
+ */
+typedef struct subDirectory {
+    file **files;   //each entry slot in order, so the name index works over it as it does the root's
+    file *entries;  //memory holding the entries
+    int slots;  //entry slots the directory has used
+    int capacity;   //entry slots there is room for before the arrays grow
+    int storing;    //slots holding an entry, a directory holding none can be removed
+    int *freeSlots; //stack of the used slots that are empty, the top is the slot the next entry takes
+    int freeCount;
+    nameIndex *index;
+    int *blocks;    //FAT index of each block of the directory's chain in order
+    int blockCount;
+    int blockCapacity;
+}subDirectory;
+
 //struct to define the structure of the Data Region
 typedef struct dataRegion {
-    //a char is a single byte, so this is a variable that can store enough bytes for a block * the number of blocks
-    block *blocks[FAT_TABLE_SIZE];
+    block **blocks;
+    char *data; //memory holding every block when the region is buffered, NULL when mapped
+    int count;  //number of blocks in the region
+    int blockSize;  //size in bytes of each block
+    char mapped; //TRUE when the blocks are views into the mapped image (not owned by the struct)
+    dirtySet *dirty;    //blocks changed since the last sync
 }dataRegion;
 
-//struct to define the structure of the file system
-typedef struct fileSystem {
+/*
+ * struct to define the structure of the file system
+ * it holds everything about one mounted image, so a process can mount any number of them
+ * and every API call takes the volume it works on (the typedef is in fs.h, where it is the volume handle)
+ */
+struct fileSystem {
     volumeBootRecord *vmb;
     fatTable *table;
     rootDirectory *dir;
     dataRegion *storage;
-}fileSystem;
+
+    //objects made and freed while the volume is mounted come from its pools, guarded like the structs holding them
+    slabPool *descriptorPool;
+    slabPool *dentryPool;
+
+    char mounted;   //TRUE from a successful mount until un-mount
+    descriptorTable *fds;   //table of open descriptors
+    dentryCache *dcache;    //cached directory entries for path resolution, they also make up the open-file table
+    struct dentry *rootNode;    //the dentry paths are resolved from, it stands for the root directory
+    regionLayout layout;    //where each region of the image lives, derived from its volume boot record
+    int filedes;    //file descriptor of the open disk file (hard storage)
+    char *image;    //the mapped disk file when mounted with MOUNT_MMAP, NULL when mounted buffered
+    int durability; //how a sync makes its writes durable, chosen at mount
+
+    //group commit state, only used by DURABLE_GROUP mounts
+    useconds_t commitWindow;    //how long a commit waits for other syncs to join it, guarded by the commit lock
+    pthread_t committer;    //thread that flushes the image once per commit window
+    pthread_mutex_t commitLock;
+    pthread_cond_t commitWake;  //signalled when a sync requests a commit
+    pthread_cond_t commitDone;  //broadcast when a flush finishes
+    uint64_t commitRequested;   //generation of the last commit requested
+    uint64_t commitFlushed; //generation the last finished flush covers, every commit up to it is durable
+    char commitFailed;  //TRUE once a flush has failed, every later commit reports it
+    char committerRunning;
+
+    //a data operation takes the volume lock shared then the locks of its descriptor and file (and the data lock to write)
+    //a metadata operation takes the volume lock shared then the metadata lock, un-mount takes the volume lock alone
+    //a sync takes the data lock exclusively before the metadata lock, as writers do, while it writes blocks out
+    pthread_rwlock_t volumeLock;    //held exclusively while the volume is un-mounted
+    pthread_rwlock_t dataLock;  //held shared while file data is written, exclusively while a sync writes blocks out
+    pthread_mutex_t metaLock;   //guards the FAT, directories, dentry cache, open-file counts and dirty sets
+    pthread_mutex_t pinLock;    //guards the read view counts, taken on its own or inside the fd lock
+    pthread_cond_t unpinned;    //signalled when a file's last read view is released
+    pthread_mutex_t fdLock; //guards changes to the descriptor table's slots, only the pin lock is taken inside it
+    pthread_cond_t fdIdle;  //signalled when the last call using a closing descriptor drops it
+};
 
 
 // ----------constructor methods----------
 
-//constructor for a new file
-file *new_file(char *name, int16_t id, int16_t size);
+//copies a name into an entry's FILE_NAME_SIZE byte name field, zero filling the rest (a full length name has no terminator)
+void set_name(char *to, const char *name);
+
+//sets up a file struct, entries live in their directory or dentry so are set in place rather than allocated
+void set_file(file *this, char *name, int32_t id, int64_t size);
+
+//constructor for a slab pool of objects of the given size
+slabPool *new_slabPool(size_t objectSize);
+
+//takes a zeroed object from a slab pool, NULL if the pool cannot grow
+void *slab_alloc(slabPool *pool);
+
+//returns an object to the slab pool it came from
+void slab_free(slabPool *pool, void *object);
+
+//constructor for a new file descriptor, taken from the given pool
+descriptor *new_descriptor(slabPool *pool, file *reps, dentry *node, int mode, off_t fp);
+
+//constructor for a dentry of the named entry at slot of parent, taken from the given pool
+//an owned entry is copied into the dentry, otherwise the dentry points at entry
+dentry *new_dentry(slabPool *pool, const char *name, dentry *parent, int slot, file *entry, char owned);
 
-//constructor for a new block;
-block *new_block(char *data);
+//constructor for the in-memory entries of a subdirectory with room for the given number of slots
+subDirectory *new_subDirectory(int slots);
 
-//constructor for a new file descriptor
-descriptor *new_descriptor(file *reps, int mode, int fp);
+//constructor for an empty dentry cache with the given number of buckets
+dentryCache *new_dentryCache(int buckets);
+
+//constructor for an empty descriptor table
+descriptorTable *new_descriptorTable();
+
+//constructor for a dirty set tracking the given number of units
+dirtySet *new_dirtySet(int units);
+
+//constructor for a free-block bitmap covering the given number of indexes, all starting full
+freeMap *new_freeMap(int entries);
+
+//constructor for an empty name index sized for the given number of entries
+nameIndex *new_nameIndex(int entries);
+
+//constructor for an empty image build
+imageBuild *new_imageBuild();
 
 //constructor for the volume boot record
-volumeBootRecord *new_VBR();
+volumeBootRecord *new_VBR(int blockSize, int blockCount, int maxFiles, int fatWidth);
 
 //constructor for the FAT
-fatTable *new_FAT();
+fatTable *new_FAT(int entries, int width);
+
+//constructor for a FAT whose table is a view into a mapped image
+fatTable *new_FAT_view(void *view, int entries, int width);
 
 //constructor for the root Dir
-rootDirectory *new_rootDir();
+rootDirectory *new_rootDir(int capacity);
+
+//constructor for a root Dir whose entries are views into a mapped image
+rootDirectory *new_rootDir_view(char *view, int capacity);
 
 //constructor for the data region
-dataRegion *new_dataRegion();
+dataRegion *new_dataRegion(int count, int blockSize);
+
+//constructor for a data region whose blocks are views into a mapped image
+dataRegion *new_dataRegion_view(char *view, int count, int blockSize);
 
 //constructor for the file system
 fileSystem *new_fileSystem(volumeBootRecord *vmb, fatTable *table, rootDirectory *dir, dataRegion *storage);
 
 // ----------freeing methods----------
 
-void free_file(file *toFree);
-void free_block(block *toFree);
-void free_descriptor(descriptor *toFree);
+void free_slabPool(slabPool *toFree);
+void free_descriptor(slabPool *pool, descriptor *toFree);
+void free_subDirectory(subDirectory *toFree);
+void free_dentry(slabPool *pool, dentry *toFree);
+void free_dentryCache(slabPool *pool, dentryCache *toFree);
+void free_descriptorTable(slabPool *pool, descriptorTable *toFree);
+void free_dirtySet(dirtySet *toFree);
+void free_freeMap(freeMap *toFree);
+void free_nameIndex(nameIndex *toFree);
 void free_VBR(volumeBootRecord *toFree);
 void free_FAT(fatTable *toFree);
-void free_rootDir(rootDirectory *toFree);
+void free_rootDirectory(rootDirectory *toFree);
 void free_dataRegion(dataRegion *toFree);
 void free_fileSystem(fileSystem *toFree);
+void free_imageBuild(imageBuild *toFree);
 
 #endif
\ No newline at end of file
@@ -1,792 +1,2666 @@
+#define _GNU_SOURCE //copy_file_range is a GNU extension
 #include "constructors.h"
 
 
 //global variables
-char mounted = FALSE;   // mounted starts false, is true when mount succeeds
-static volumeBootRecord *vmb = NULL;    // the struct for storing the transient data of the VBR
-static fatTable *table = NULL;  // the struct for storing the transient data of the FAT
-static rootDirectory *rootDir = NULL;   //the struct for storing the transient data of the directory
-static dataRegion *storage = NULL;  //the struct for storing the transient data for each data block
-static fileSystem *fs = NULL;   // the struct for storing all other transient structs for ease of use
-static descriptor *fds[MAX_OPEN_FILES];  //list of file descriptors for open files
-static int filedes = -1;    // global variable for storing the file descriptor for the open disk file (hard storage)
+
+//statistics, each thread counts into its own block and the blocks of finished threads are folded into statsRetired
+static __thread statsBlock *statsLocal = NULL;
+static statsBlock *statsThreads = NULL;
+static fsStats statsRetired;
+static pthread_mutex_t statsLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t statsKey;
+static pthread_once_t statsOnce = PTHREAD_ONCE_INIT;
+
+//volume locks the calling thread holds, and whether an error reported under them still owes its pause
+static __thread int volumeLocksHeld = 0;
+static __thread char pauseOwed = FALSE;
 
 
 // processing functions
 
+/*
+ * pauses after an error is reported so its message can be read
+ * a thread holding a volume lock owes the pause until it lets the lock go (see volume_unlock),
+ * so other calls on the volume are never held up by it
+ */
+void error_pause() {
+    if (volumeLocksHeld > 0) pauseOwed = TRUE;
+    else usleep(SLEEP_USECS);
+}
+
 //error handler fn for C system errors
 char handleError_p(char *errMsg) {
     perror(errMsg);
-    sleep(SLEEP_USECS);
+    error_pause();
     return ERR;
 }
 
 //error handler fn for internal logic errors
 char handleError(char *errMsg) {
     fprintf(stderr, "%s\n", errMsg);
-    usleep(SLEEP_USECS);
+    error_pause();
     return ERR;
 }
 
-/*
- * write the data of the volume boot record to a given file
- * returns 1 on success and -1 on failure
- * Does not need to take in the vmb as it is a global variable
- * could potentially lose the int fd param as well since there is a global filedes
-*/
-int writeVolumeBootRecord(int fd) {
-
-    char bytes = 4; //each value in the VBR is at most 4 bytes
-
-    if (write(fd, &(vmb->fsId), bytes) == ERR) return handleError_p("writeVolumeBootRecord - could not write id");
-    if (write(fd, &(vmb->blockSize), bytes) == ERR)
-        return handleError_p("writeVolumeBootRecord - could not write block size");
-    if (write(fd, &(vmb->maxFiles), bytes) == ERR)
-        return handleError_p("writeVolumeBootRecord - could not write max files");
-
-    return SUC;
-}
+// volume and locking functions
 
 /*
- * write the data of the File Allocation Table to a given file
- * returns 1 on success and -1 on failure
- * Does not need to take in the FAT as it is a global variable
- * could potentially lose the int fd param as well since there is a global filedes
-*/
-int writeFAT(int fd) {
-    char entryBytes = 1;    //each entry in the table is a single byte
-    int offsetLocation = lseek(fd, FAT_REGION_OFST, SEEK_SET);
-    if (offsetLocation == ERR) return handleError_p("writeFAT - could not shift fd");
-
-    char *fat = table->table;
-    for (int i = 0; i <= FAT_TABLE_SIZE; i++) {
-        char current = fat[i];
-        if (write(fd, &current, entryBytes) == ERR) return handleError_p("writeFAT - couldn't write index");
-    }
-
+ * checks a volume was given, every API call checks the volume it is given before doing anything else
+ * the volume is then passed on to every function the call uses, so any number can be in use at once
+ */
+int volume_check(fileSystem *volume) {
+    if (volume == NULL) return handleError("no volume given - mount one with mount_fs");
     return SUC;
 }
 
-/*
- * write the data of the root (only) directory to a given file
- * returns 1 on success and -1 on failure
- * Does not need to take in the dir as it is a global variable
- * could potentially lose the int fd param as well since there is a global filedes
-*/
-int writeDir(int fd) {
-    int offsetLocation = lseek(fd, ROOT_DIR_OFST, SEEK_SET);
-    if (offsetLocation == ERR) return handleError_p("writeDir - could not move to directory offset");
-
-    for (int i = 0; i < MAX_ENTRIES; i++) {
-        file *current = rootDir->files[i];
-
-        if (write(fd, current->name, FILE_NAME_SIZE) == ERR)
-            return handleError_p("writeDir - could not write file entry name");
-        if (write(fd, &(current->fatIndex), FILE_METADATA_SIZE) == ERR)
-            return handleError_p("writeDir - could not write file fat index");
-        if (write(fd, &(current->size), FILE_METADATA_SIZE) == ERR)
-            return handleError_p("writeDir - could not write file size");
+//takes the volume lock, which every call holds shared and un-mount holds exclusively
+void volume_lock(fileSystem *volume, int exclusive) {
+    if (exclusive) pthread_rwlock_wrlock(&volume->volumeLock);
+    else pthread_rwlock_rdlock(&volume->volumeLock);
+    volumeLocksHeld++;
+}
 
+//lets the volume lock go, then takes the pause of any error reported while it was held
+void volume_unlock(fileSystem *volume) {
+    pthread_rwlock_unlock(&volume->volumeLock);
+    if (--volumeLocksHeld == 0 && pauseOwed) {
+        pauseOwed = FALSE;
+        usleep(SLEEP_USECS);
     }
-
-    return SUC;
 }
 
 /*
- * write the data of data region to a given file
- * returns 1 on success and -1 on failure
- * Does not need to take in the data region struct as it is a global variable
- * could potentially lose the int fd param as well since there is a global filedes
-*/
-int writeDataRegion(int fd) {
-    int offsetLocation = lseek(fd, DATA_REGION_OFST, SEEK_SET);
-    if (offsetLocation == ERR) return handleError_p("writeDataRegion - could not move to data region offset");
-
-    for (int i = FIRST_FAT_INDEX; i < MAX_ENTRIES; i++) {
-        block *current = storage->blocks[i];
-        if (write(fd, &(current->data), BLOCK_SIZE) == ERR)
-            return handleError_p("writeDataRegion - could not write block");
-    }
+ * takes the locks a metadata operation runs under, the volume shared then the metadata lock
+ * reads and writes of file data carry on meanwhile, only a sync copying blocks out waits for writers (see sync_write)
+ */
+void meta_lock(fileSystem *volume) {
+    volume_lock(volume, FALSE);
+    pthread_mutex_lock(&volume->metaLock);
+}
 
-    return SUC;
+void meta_unlock(fileSystem *volume) {
+    pthread_mutex_unlock(&volume->metaLock);
+    volume_unlock(volume);
 }
 
+// statistics functions
+
 /*
- * Initialises the File System with default data
- * VMB starts with it's values from the header
- * The FAT is initialised as completely free
- * The directory is initialised with a set of empty file entries
- * The data region is assigned a series of NULL values
+ * adds a thread's counters to the totals being summed
+ * the counters are read as their thread writes them, so each is read whole with a relaxed atomic load
  */
-int initialise_fs(int fd) {
-    //initialise the VMB as a new (empty) struct and write to "disk"
-    vmb = new_VBR();
-    if (vmb == NULL) return ERR;
-    if (writeVolumeBootRecord(fd) == ERR) return ERR;
-
-    //initialise the FAT as a new (empty) struct and write to "disk"
-    table = new_FAT();
-    if (table == NULL) return ERR;
-    if (writeFAT(fd) == ERR) return ERR;
-
-    //initialise the directory as a new (empty) struct and write to disk
-    rootDir = new_rootDir();
-    if (rootDir == NULL) return ERR;
-    if (writeDir(fd) == ERR) return ERR;
+void stats_sum(fsStats *total, fsStats *counts) {
+    uint64_t *to = (uint64_t *) total, *from = (uint64_t *) counts;
+    for (size_t i = 0; i < sizeof(fsStats) / sizeof(uint64_t); i++) to[i] += __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+}
 
-    //initialise the data region as a new (empty) struct and write to disk
-    storage = new_dataRegion();
-    if (storage == NULL) return ERR;
-    if (writeDataRegion(fd) == ERR) return ERR;
+//run as a thread that has counted exits, its counts are kept in statsRetired and its block freed
+void stats_retire(void *block) {
+    statsBlock *retiring = block;
+    pthread_mutex_lock(&statsLock);
+    stats_sum(&statsRetired, &retiring->counts);
+    if (retiring->prev != NULL) retiring->prev->next = retiring->next;
+    else statsThreads = retiring->next;
+    if (retiring->next != NULL) retiring->next->prev = retiring->prev;
+    pthread_mutex_unlock(&statsLock);
+    free(retiring);
+}
 
-    return SUC;
+void stats_makeKey() {
+    pthread_key_create(&statsKey, stats_retire);
 }
 
-/*
- * When a file system is created it:
- *  - creates a file with the given name to save persistent data -using create_fs
- *  - opens that file
- *  - creates the volume boot record and writes that data to the file
- *  - creates the fat table and writes that data to the file (at it's offset)
- *  - closes the file
- */
-int make_fs(char *store_name) {
-    int flags = O_WRONLY | O_CREAT | O_TRUNC;
-    int mode = 0777;
+//the calling thread's counters, listed the first time it counts anything, NULL if they cannot be allocated
+fsStats *stats_local() {
+    if (statsLocal != NULL) return &statsLocal->counts;
+
+    statsBlock *block = calloc(1, sizeof(statsBlock));
+    if (block == NULL) return NULL;
+    pthread_once(&statsOnce, stats_makeKey);
+    pthread_setspecific(statsKey, block);
+    pthread_mutex_lock(&statsLock);
+    block->next = statsThreads;
+    if (statsThreads != NULL) statsThreads->prev = block;
+    statsThreads = block;
+    pthread_mutex_unlock(&statsLock);
+
+    statsLocal = block;
+    return &block->counts;
+}
 
-    int fd = open(store_name, flags, mode);
+//adds to one of the calling thread's counters, only this thread writes it so the store needs no lock
+void stats_add(uint64_t *counter, uint64_t amount) {
+    __atomic_store_n(counter, *counter + amount, __ATOMIC_RELAXED);
+}
 
-    if (fd <= 0) return handleError_p("make_fs - could not create or open store file");
-    else {
+//counts a system call made on an image or host file
+void stats_syscall() {
+    fsStats *counts = stats_local();
+    if (counts != NULL) stats_add(&counts->syscalls, 1);
+}
 
-        initialise_fs(fd);
+//counts a system call that makes the image durable
+void stats_flush() {
+    fsStats *counts = stats_local();
+    if (counts == NULL) return;
+    stats_add(&counts->syscalls, 1);
+    stats_add(&counts->flushes, 1);
+}
 
-        close(fd);
-        return SUC;
-    }
+//the time an operation starts, in nanoseconds
+uint64_t stats_start() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000u + now.tv_nsec;
 }
 
 /*
- * function for loading the data from the "disk" file into transient storage (struct)
- * checks the file system is mounted
- * then reads the contents of the volume boot record
- * then if they are read correctly writes those values into the vmb struct
- * if vmb is not initialised then it will initialise it
+ * counts a call of an operation that started at start and finished with result, adding it to the operation's histogram
+ * a call that reads or writes a file adds the bytes it moved, the result is passed back so a call can return through this
  */
-int load_volumeBoot() {
-    if (!mounted) return handleError("load_volumeBoot - file system not mounted");
-    //move the pointer to the offset fot the volume boot
-    if (lseek(filedes, VOLUME_RECORD_OFST, SEEK_SET) == ERR)
-        return handleError_p("load_volumeBoot - could not move to volume boot offset");
-
-    char bytes = 4;
-    int32_t id;
-    int32_t blockSize;
-    int32_t maxFiles;
-
-    if (read(filedes, &id, bytes) == ERR) return handleError_p("load_volumeBoot - could not read id");
-    if (read(filedes, &blockSize, bytes) == ERR) return handleError_p("load_volumeBoot - could not read block size");
-    if (read(filedes, &maxFiles, bytes) == ERR) return handleError_p("load_volumeBoot - could not read max files");
-
-    if (vmb == NULL) vmb = new_VBR();
-
-    vmb->fsId = id;
-    vmb->blockSize = blockSize;
-    vmb->maxFiles = maxFiles;
-
-    return SUC;
+ssize_t stats_done(int op, uint64_t start, ssize_t result) {
+    fsStats *counts = stats_local();
+    if (counts == NULL) return result;
+
+    uint64_t took = stats_start() - start;
+    int bucket = 0;
+    while (bucket < STATS_LATENCY_BUCKETS - 1 && (took >> (bucket + 1)) != 0) bucket++;
+    stats_add(&counts->calls[op], 1);
+    stats_add(&counts->latency[op][bucket], 1);
+    if (result > 0 && (op == STATS_READ || op == STATS_VIEW || op == STATS_EXPORT)) stats_add(&counts->bytesRead, result);
+    if (result > 0 && (op == STATS_WRITE || op == STATS_IMPORT)) stats_add(&counts->bytesWritten, result);
+    return result;
 }
 
 /*
- * Loads the value of the FAT stored on "disk" to the in memory struct
+ * Function for reading the library's counters, the sum of those of every thread that has used it
+ * including threads that have since exited
+ * returns 0, or ERR if no struct is given
  */
-int load_fat() {
-    if (!mounted) return handleError("load_fat - file system not mounted");
+int fs_stats(fsStats *out) {
+    if (out == NULL) return handleError("cannot read statistics - no struct given");
+    memset(out, 0, sizeof(fsStats));
+    pthread_mutex_lock(&statsLock);
+    stats_sum(out, &statsRetired);
+    for (statsBlock *current = statsThreads; current != NULL; current = current->next) stats_sum(out, &current->counts);
+    pthread_mutex_unlock(&statsLock);
+    return SUC;
+}
 
-    //move the pointer to the offset fot the volume boot
-    if (lseek(filedes, FAT_REGION_OFST, SEEK_SET) == ERR)
-        return handleError_p(
-                "load_fat - could not move to FAT offset");
+// dirty tracking functions
 
-    if (table == NULL) table = new_FAT();
+//marks a unit of a region as changed since the last sync, each unit is only listed once
+void markDirty(dirtySet *set, int unit) {
+    if (set->flags[unit]) return;
+    set->flags[unit] = TRUE;
+    set->list[set->count++] = unit;
+}
 
-    char bytes = 1;
-    char current;
+//marks every unit of a region as changed, used when nothing has been written to disk yet
+void markAllDirty(dirtySet *set) {
+    for (int i = 0; i < set->units; i++) markDirty(set, i);
+}
 
-    for (int i = FIRST_FAT_INDEX; i <= LAST_FAT_INDEX; i++) {
-        if (read(filedes, &current, bytes) == ERR) return handleError_p("load_fat - cannot read fat index");
-        table->table[i] = current;
+//empties the set after its units have been written
+void clearDirty(dirtySet *set) {
+    for (int i = 0; i < set->count; i++) set->flags[set->list[i]] = FALSE;
+    set->count = 0;
+}
 
-        //find the first free index (stays as -1 (ERR) if one does not exist)
-        if (current == '0') {
-            if (table->nextFreeSlot == -1 || table->nextFreeSlot > i) table->nextFreeSlot = i;
-        } else table->storing++;  //if index is not free then it is full, plus the counter
-    }
+int compareUnits(const void *a, const void *b) {
+    return *(const int *) a - *(const int *) b;
+}
 
-    return SUC;
+//sorts the listed units so that neighbouring units can be written as a single run
+void sortDirty(dirtySet *set) {
+    qsort(set->list, set->count, sizeof(int), compareUnits);
 }
 
 /*
- * stores the directory data on the "disk" file into the transient struct
+ * takes the next run of consecutive dirty units from a sorted set
+ * position is the index into the list to continue from and is moved past the run
+ * returns FALSE once every run has been taken
  */
-int load_directory() {
-    if (!mounted) return handleError("load_directory - file system not mounted");
-
-    //move the file pointer to the directory's offset
-    if (lseek(filedes, ROOT_DIR_OFST, SEEK_SET) == ERR)
-        return handleError_p("load_directory - could not move to directory offset");
-
-    if (rootDir == NULL) rootDir = new_rootDir();
-
-    char name[FILE_NAME_SIZE];
-    int16_t index;
-    int16_t size;
-
+int nextDirtyRun(dirtySet *set, int *position, int *start, int *length) {
+    if (*position >= set->count) return FALSE;
+
+    *start = set->list[*position];
+    *length = 1;
+    (*position)++;
+    while (*position < set->count && set->list[*position] == *start + *length) {
+        (*length)++;
+        (*position)++;
+    }
+    return TRUE;
+}
 
-    for (int i = 0; i < MAX_ENTRIES; i++) {
-        if (read(filedes, &name, FILE_NAME_SIZE) == ERR)
-            return handleError_p("load_directory - cannot read file struct name");
-        if (read(filedes, &index, FILE_METADATA_SIZE) == ERR)
-            return handleError_p("load_directory - cannot read file struct index");
-        if (read(filedes, &size, FILE_METADATA_SIZE) == ERR)
-            return handleError_p("load_directory - cannot read file struct size");
+// descriptor table functions
 
-        //create new file object and add it to the directory
-        file *insert = new_file(name, index, size);
-        rootDir->files[i] = insert;
+//slot of the table with the given number, the chunk holding it must have been allocated
+fdSlot *fdTable_slot(fileSystem *volume, int slot) {
+    return &volume->fds->chunks[slot / FD_CHUNK_SLOTS][slot % FD_CHUNK_SLOTS];
+}
 
-        //if the file exists (non-default struct) then increase the storage count
-        //otherwise check to see if a new firstFreeINdex should be assigned
-        if (strcmp(insert->name, "") != 0) rootDir->storing++;
-        else if (rootDir->nextFreeSlot == -1 || rootDir->nextFreeSlot > i) rootDir->nextFreeSlot = i;
+/*
+ * finds the descriptor an fd names, in constant time
+ * returns NULL if the fd is out of range, its slot is free or its generation is stale
+ * (the slot has been closed and perhaps reused since the fd was handed out)
+ * the caller holds the fd lock, or the volume exclusively, so the slot cannot change under it
+ */
+descriptor *fdTable_get(fileSystem *volume, int fd) {
+    if (fd < 0) return NULL;
+    int slot = fd & (MAX_OPEN_FILES - 1);
+    //the chunk is checked rather than the slot count, chunks are never freed while the volume is mounted
+    if (volume->fds->chunks[slot / FD_CHUNK_SLOTS] == NULL) return NULL;
+    fdSlot *entry = fdTable_slot(volume, slot);
+    if (entry->desc == NULL || (uint32_t) (fd >> FD_SLOT_BITS) != entry->generation) return NULL;
+    return entry->desc;
+}
 
+/*
+ * puts a descriptor in the table and returns the fd naming it
+ * a closed slot is reused first (the most recently closed), otherwise the next unused slot is taken
+ * and a new chunk of slots allocated when the last one is full
+ * the table is changed under the fd lock so calls looking up other fds never see it part way through
+ * returns -1 if the table is full or cannot grow
+ */
+int fdTable_add(fileSystem *volume, descriptor *toAdd) {
+    descriptorTable *table = volume->fds;
+    pthread_mutex_lock(&volume->fdLock);
+    int slot = table->freeHead;
+    if (slot != -1) {
+        table->freeHead = fdTable_slot(volume, slot)->nextFree;
+    } else {
+        fdSlot *chunk = NULL;
+        if (table->slots == MAX_OPEN_FILES || (table->slots % FD_CHUNK_SLOTS == 0 &&
+                (chunk = calloc(FD_CHUNK_SLOTS, sizeof(fdSlot))) == NULL)) {
+            pthread_mutex_unlock(&volume->fdLock);
+            return ERR;
+        }
+        //a new chunk is published filled in, desc_take finds it without the lock
+        if (chunk != NULL) __atomic_store_n(&table->chunks[table->slots / FD_CHUNK_SLOTS], chunk, __ATOMIC_RELEASE);
+        slot = table->slots++;
     }
 
-    return SUC;
+    fdSlot *entry = fdTable_slot(volume, slot);
+    toAdd->slot = slot;
+    entry->nextFree = -1;
+    __atomic_store_n(&entry->closing, FALSE, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&entry->desc, toAdd, __ATOMIC_SEQ_CST);
+    table->open++;
+    int fd = (int) (entry->generation << FD_SLOT_BITS) | slot;
+    pthread_mutex_unlock(&volume->fdLock);
+    return fd;
 }
 
 /*
- * Loads the data from the "disk" file's data region to the transient in memory structs
+ * takes the descriptor an fd names out of the table and returns it, or NULL if the fd names none
+ * the slot's generation moves on so the fd (and any copy of it) no longer finds anything
+ * the caller holds the fd lock (see desc_detach)
  */
-int load_dataRegion() {
-    if (!mounted) return handleError("load_dataRegion - file system not mounted");
+descriptor *fdTable_remove(fileSystem *volume, int fd) {
+    descriptor *desc = fdTable_get(volume, fd);
+    if (desc == NULL) return NULL;
+
+    int slot = fd & (MAX_OPEN_FILES - 1);
+    fdSlot *entry = fdTable_slot(volume, slot);
+    __atomic_store_n(&entry->desc, NULL, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&entry->generation, (entry->generation + 1) & FD_GENERATION_MASK, __ATOMIC_SEQ_CST);
+    entry->nextFree = volume->fds->freeHead;
+    volume->fds->freeHead = slot;
+    volume->fds->open--;
+    return desc;
+}
 
-    if (lseek(filedes, DATA_REGION_OFST, SEEK_SET) == ERR) return ERR;
+//the fd currently naming the given slot, used to walk every open descriptor
+int fdTable_fd(fileSystem *volume, int slot) {
+    return (int) (fdTable_slot(volume, slot)->generation << FD_SLOT_BITS) | slot;
+}
 
-    if (storage == NULL) storage = new_dataRegion();
-    char val[BLOCK_SIZE];
+//TRUE if read views taken through the descriptor are still held, a NULL descriptor has none
+int desc_hasViews(fileSystem *volume, descriptor *desc) {
+    if (desc == NULL) return FALSE;
+    pthread_mutex_lock(&volume->pinLock);
+    int views = desc->views;
+    pthread_mutex_unlock(&volume->pinLock);
+    return views > 0;
+}
 
-    for (int i = 0; i < FAT_TABLE_SIZE; i++) {
-        if (read(filedes, val, BLOCK_SIZE) == ERR) return handleError_p("load_dataRegion - couldn't read block");
-        storage->blocks[i] = new_block(val);
+//drops a reference counted in a slot, waking a close waiting for the slot's descriptor once it was the last
+void slot_drop(fileSystem *volume, fdSlot *entry) {
+    if (__atomic_sub_fetch(&entry->refs, 1, __ATOMIC_SEQ_CST) == 0 && __atomic_load_n(&entry->closing, __ATOMIC_SEQ_CST)) {
+        pthread_mutex_lock(&volume->fdLock);
+        pthread_cond_broadcast(&volume->fdIdle);
+        pthread_mutex_unlock(&volume->fdLock);
     }
-
-    return SUC;
 }
 
 /*
- *  Function for setting the global file system struct to represent the in memory data
- *  calls all the other load functions and then creates a new file system using them
- *  then returns 0 (or -1 if it fails at any point)
+ * takes a reference to the descriptor an fd names for a call to use, without taking the fd lock
+ * the reference is counted in the slot (which is never freed while the volume is mounted) before the slot is checked,
+ * so a close either sees it and waits or has already marked the slot closing and the reference is dropped again
+ * the descriptor is not freed while any reference is held (see desc_detach)
+ * returns NULL if the fd names no descriptor or its descriptor is being closed
  */
-int load_fileSystem() {
-    if (!mounted) return handleError("load_fileSystem - file system not mounted");
-
-    if (load_volumeBoot() == ERR) return ERR;
-    if (load_fat() == ERR) return ERR;
-    if (load_directory() == ERR) return ERR;
-    if (load_dataRegion() == ERR) return ERR;
+descriptor *desc_take(fileSystem *volume, int fd) {
+    if (fd < 0) return NULL;
+    int slot = fd & (MAX_OPEN_FILES - 1);
+    fdSlot *chunk = __atomic_load_n(&volume->fds->chunks[slot / FD_CHUNK_SLOTS], __ATOMIC_ACQUIRE);
+    if (chunk == NULL) return NULL;
+    fdSlot *entry = &chunk[slot % FD_CHUNK_SLOTS];
+
+    __atomic_add_fetch(&entry->refs, 1, __ATOMIC_SEQ_CST);
+    descriptor *desc = __atomic_load_n(&entry->desc, __ATOMIC_SEQ_CST);
+    if (desc == NULL || __atomic_load_n(&entry->generation, __ATOMIC_SEQ_CST) != (uint32_t) (fd >> FD_SLOT_BITS) ||
+            __atomic_load_n(&entry->closing, __ATOMIC_SEQ_CST)) {
+        slot_drop(volume, entry);
+        return NULL;
+    }
+    return desc;
+}
 
-    fs = new_fileSystem(vmb, table, rootDir, storage);
-    if (fs != NULL) return SUC;
-    else return ERR;
+//drops a reference taken with desc_take, the descriptor may be freed as soon as it is
+void desc_drop(fileSystem *volume, descriptor *desc) {
+    slot_drop(volume, fdTable_slot(volume, desc->slot));
 }
 
 /*
- * syncs the transient data in the structs to the
- * hard memory in the file
- * meaning that all data represented in the
- * file corresponds to the process data
- *
- * then calls the posix sync function to sync the
- * hard data file changes to the device's main file system
- *
- * returns Success if everything is synced otherwise returns an error
+ * takes the descriptor an fd names out of the table so it can be freed
+ * once the close has begun no new call can take the descriptor, and the calls already using it
+ * are waited for, so nothing else holds it when it is returned
+ * returns NULL, with the fd still open, if it names no descriptor, is already being closed or has read views held
  */
-int fs_sync() {
-    if (!mounted) handleError("cannot sync file system - file system has not been mounted");
-
-    //sync the volume boot record - not necessary but safety
-    if (writeVolumeBootRecord(filedes) == ERR)
-        return handleError("cannot sync file system - could not sync volume boot record");
-
-    if (writeFAT(filedes) == ERR)
-        return handleError("cannot sync file system - could not sync FAT");
+descriptor *desc_detach(fileSystem *volume, int fd) {
+    pthread_mutex_lock(&volume->fdLock);
+    descriptor *desc = fdTable_get(volume, fd);
+    fdSlot *entry = desc == NULL ? NULL : fdTable_slot(volume, desc->slot);
+    if (desc == NULL || entry->closing) {
+        pthread_mutex_unlock(&volume->fdLock);
+        handleError("cannot close file - file is not open");
+        return NULL;
+    }
+    __atomic_store_n(&entry->closing, TRUE, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&entry->refs, __ATOMIC_SEQ_CST) > 0) pthread_cond_wait(&volume->fdIdle, &volume->fdLock);
+
+    //a call that was still running may have taken a view, so they are counted once none is left
+    if (desc_hasViews(volume, desc)) {
+        __atomic_store_n(&entry->closing, FALSE, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&volume->fdLock);
+        handleError("cannot close file - read views taken through it are still held");
+        return NULL;
+    }
+    fdTable_remove(volume, fd);
+    pthread_mutex_unlock(&volume->fdLock);
+    return desc;
+}
 
-    if (writeDir(filedes) == ERR)
-        return handleError("cannot sync file system - could not sync directory");
+// free-block bitmap functions
 
-    if (writeDataRegion(filedes) == ERR)
-        return handleError("cannot sync file system - could not sync data region");
+//sets or clears the bit of an index in the free-block bitmap, keeping the summary bit of its word in step
+void freeMap_mark(freeMap *map, int index, int isFree) {
+    int word = index / MAP_WORD_BITS;
+    uint64_t bit = (uint64_t) 1 << (index % MAP_WORD_BITS);
 
-    sync(); //sync is always successful
+    if (isFree) map->words[word] |= bit;
+    else map->words[word] &= ~bit;
 
-    return SUC;
+    uint64_t summaryBit = (uint64_t) 1 << (word % MAP_WORD_BITS);
+    if (map->words[word] != 0) map->summary[word / MAP_WORD_BITS] |= summaryBit;
+    else map->summary[word / MAP_WORD_BITS] &= ~summaryBit;
 }
 
-
 /*
- * checks the file system is mounted and the specified file is open
- * then frees the specified file's file descriptor sets array index to NULL
- * then calls sync to write the updated file to memory
- *
- * if all checks pass returns 0 else returns -1
+ * finds the lowest free index at or after the given one
+ * the word holding it is checked first, then the summary is scanned for the next word with a
+ * free bit so each step covers 64 words (4096 indexes) however full the volume is
+ * returns ERR if there is no free index left
  */
-int fs_close(int fd) {
-    if (!mounted) return handleError("cannot close file - file system is not mounted");
-    if (fds[fd] == NULL) return handleError("cannot close file - file is not open");
-
-    //remove the file descriptor
-    free_descriptor(fds[fd]);
-    fds[fd] = NULL;
-
-    if (fs_sync() == ERR) return handleError("could not sync file");
-
-    return SUC;
+int freeMap_find(freeMap *map, int from) {
+    int word = from / MAP_WORD_BITS;
+    if (word >= map->wordCount) return ERR;
+
+    uint64_t bits = map->words[word] & (~(uint64_t) 0 << (from % MAP_WORD_BITS));
+    if (bits != 0) return word * MAP_WORD_BITS + __builtin_ctzll(bits);
+
+    int next = word + 1;
+    for (int s = next / MAP_WORD_BITS, shift = next % MAP_WORD_BITS; s < map->summaryCount; s++, shift = 0) {
+        uint64_t words = map->summary[s] & (~(uint64_t) 0 << shift);
+        if (words != 0) {
+            int found = s * MAP_WORD_BITS + __builtin_ctzll(words);
+            return found * MAP_WORD_BITS + __builtin_ctzll(map->words[found]);
+        }
+    }
+    return ERR;
 }
 
 /*
- * Mounts an existing file system
- * this allows it's data to be read and edited
- * it does this by:
- * - attempting to open the file
- * - reading the volume boot record
- * - isolating the initial value
- * - comparing it to the stored ident int
- * - if successfully mounted call the load functions to initialise the structs
- * - if one fails un-mount the system
- * (for now just return -1 and set values but after unmount is initialised then can use it)]
- *
+ * counts the free indexes in a row starting at the given one, stopping at max
+ * each step takes the run of set bits left in a word with one count-trailing-zeros
  */
-int mount_fs(char *store_name) {
-    char vmbBytes = 4; //each volume boot record value is at most 4 bytes (if they are not 4 bytes the rest are NULL)
-    int flags = O_RDWR;
-    int fd = open(store_name, flags);
-    if (fd == ERR) return handleError_p("mount_fs - cannot open file");
-
-    int32_t ident;
-    int32_t bs;
-    int32_t mf;
-    size_t readOut;
-
-    if ((readOut = read(fd, &ident, vmbBytes)) == ERR) return handleError_p("mount_fs - cannot read from file");
-    if (readOut == ERR) return handleError_p("mount_fs - could not read boot record");
-
-    if ((readOut = read(fd, &bs, vmbBytes)) == ERR) return handleError_p("mount_fs - cannot read from file");
-    if (readOut == ERR) return handleError_p("mount_fs - could not read boot record");
-
-    if ((readOut = read(fd, &mf, vmbBytes)) == ERR) return handleError_p("mount_fs - cannot read from file");
-    if (readOut == ERR) return handleError_p("mount_fs - could not read boot record");
-
-    //check the file has a matching identifier to the header file macro
-    if (IDENT != ident) return handleError_p("mount_fs - invalid Identifier");
-
-    //These two should probably lead to changes being made, but that would require global vars instead of macros so do it later
-    if (BLOCK_SIZE != bs) return handleError_p("mount_fs - file's block size different from Macro");
-    if (MAX_ENTRIES != mf) return handleError_p("mount_fs - file's max files is different from Macro");
-
-    //assign global variables
-    mounted = TRUE;
-    filedes = fd;
-
-    //load the disk memory into transient storage
-    load_fileSystem();
-
-    return SUC;
+int freeMap_runLength(freeMap *map, int index, int max) {
+    int length = 0;
+    while (length < max) {
+        int at = index + length;
+        int word = at / MAP_WORD_BITS;
+        if (word >= map->wordCount) break;
+
+        int available = MAP_WORD_BITS - (at % MAP_WORD_BITS);
+        uint64_t taken = ~(map->words[word] >> (at % MAP_WORD_BITS));
+        int run = taken == 0 ? MAP_WORD_BITS : __builtin_ctzll(taken);
+        if (run > available) run = available;
+
+        length += run;
+        if (run < available) break;
+    }
+    return length < max ? length : max;
 }
 
 /*
- * This function syncs the process structs (transient data)
- * with the hard file data meaning that all changes made to the file
- * using the structs will be written back to the file
- *
- * if syncing fails so will mount
- * otherwise mount will then close any open file descriptors
- * then close the underlying hard disk file
- * final step is to rest global variables and free structs
- * if all operations succeed it will return 0
- * otherwise it will return -1 and a relevant message
+ * finds the first run of want free indexes at or after the given one
+ * only EXTENT_PROBES runs are examined so a fragmented volume cannot make allocation slow,
+ * when none of them is long enough the longest one seen is returned
+ * returns ERR if there is no free index left, otherwise the start of the run and its length in length
  */
-int umount_fs() {
-    //sync the process data to the file
-    if (fs_sync() == ERR) return handleError("could not fully sync file system - no process changes made");
-
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        descriptor *current = fds[i];
-        if (current != NULL) {
-            fs_close(i);    //close and free the file descriptors
+int freeMap_findRun(freeMap *map, int from, int want, int *length) {
+    int best = ERR;
+    *length = 0;
+
+    int at = freeMap_find(map, from);
+    for (int probes = 0; at != ERR && probes < EXTENT_PROBES; probes++) {
+        int run = freeMap_runLength(map, at, want);
+        if (run > *length) {
+            best = at;
+            *length = run;
         }
+        if (run == want) break;
+        at = freeMap_find(map, at + run);
     }
+    return best;
+}
 
-    //finally close the underlying file
-    if (close(filedes) == ERR) return handleError_p("could not un-mount file system");
+/*
+ * reads a FAT index as an engine value whatever the width of the table
+ * a FAT-8 table stores its markers as single characters so they are widened to
+ * FAT_FREE, FAT_END and FAT_RESERVED
+ */
+uint32_t fat_get(fileSystem *volume, int index) {
+    if (volume->table->width == FAT_WIDTH_32) return ((uint32_t *) volume->table->table)[index];
+
+    u_char value = ((u_char *) volume->table->table)[index];
+    switch (value) {
+        case FAT8_FREE: return FAT_FREE;
+        case FAT8_END: return FAT_END;
+        case FAT8_RESERVED: return FAT_RESERVED;
+        default: return value;
+    }
+}
 
-    //if all checks passed then reset the global variables
-    mounted = FALSE;
-    filedes = -1;
+/*
+ * sets a FAT index to the given engine value and marks its chunk for the next sync
+ * the free-block bitmap, the count of full indexes and the lowest free index follow every
+ * change between free and full
+ */
+void fat_set(fileSystem *volume, int index, uint32_t value) {
+    int wasFree = fat_get(volume, index) == FAT_FREE;
+    if (wasFree != (value == FAT_FREE)) {
+        fsStats *counts = stats_local();
+        if (counts != NULL) stats_add(wasFree ? &counts->blocksAllocated : &counts->blocksFreed, 1);
+        freeMap_mark(volume->table->free, index, value == FAT_FREE);
+        volume->table->storing += wasFree ? 1 : -1;
+        if (value == FAT_FREE && (volume->table->nextFreeSlot == ERR || index < volume->table->nextFreeSlot)) volume->table->nextFreeSlot = index;
+        else if (index == volume->table->nextFreeSlot) volume->table->nextFreeSlot = freeMap_find(volume->table->free, index);
+    }
 
-    //then free the transient data structs
-    free_fileSystem(fs);
+    if (volume->table->width == FAT_WIDTH_32) {
+        ((uint32_t *) volume->table->table)[index] = value;
+        markDirty(volume->table->dirty, (index * sizeof(uint32_t)) / FAT_SYNC_CHUNK);
+        return;
+    }
 
-    return SUC;
+    u_char stored;
+    switch (value) {
+        case FAT_FREE: stored = FAT8_FREE; break;
+        case FAT_END: stored = FAT8_END; break;
+        case FAT_RESERVED: stored = FAT8_RESERVED; break;
+        default: stored = (u_char) value;
+    }
+    ((u_char *) volume->table->table)[index] = stored;
+    markDirty(volume->table->dirty, index / FAT_SYNC_CHUNK);
 }
 
-//finds either a specific index and returns the value stored there
-int fat_findFreeIndex(int iterateFrom) {
-    if (!mounted) return handleError("cannot access FAT of non-mounted file system");
+// name index functions
 
-    if (iterateFrom < FIRST_FAT_INDEX || iterateFrom > LAST_FAT_INDEX)
-        return handleError("fat_findFreeIndex - index out of bounds");
-
-    for (int i = iterateFrom; i <= LAST_FAT_INDEX; i++) {
-        char current = table->table[i];
-        if (current == '0') return i;
+//FNV-1a hash of a file name, a full length name has no terminator so only FILE_NAME_SIZE bytes are read
+uint32_t nameIndex_hash(const char *name) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < FILE_NAME_SIZE && name[i] != '\0'; i++) {
+        hash ^= (u_char) name[i];
+        hash *= 16777619u;
     }
-    return ERR;
+    return hash;
 }
 
 /*
- * Iterative loop to find the next free space for a file
- * after the passed in index
- *
- * often used after adding a file to the previous firstFreeIndex
- * to look for the next free index after the last is filled
+ * finds the slot of a directory's name index holding the entry with the given name
+ * files are the directory's entries, which the index slots refer to
+ * returns the empty slot ending the probe instead when there is no such entry
  */
-int dir_findFreeIndex(int iterateFrom) {
-    if (!mounted) return handleError("cannot access directory of non-mounted file system");
+int nameIndex_slot(nameIndex *index, file **files, const char *name) {
+    int mask = index->capacity - 1;
+    int slot = nameIndex_hash(name) & mask;
 
-    if (iterateFrom < 0 || iterateFrom > MAX_ENTRIES) return handleError("dir_findFreeIndex - index out of bounds");
+    while (index->slots[slot] != -1 && strncmp(files[index->slots[slot]]->name, name, FILE_NAME_SIZE) != 0)
+        slot = (slot + 1) & mask;
+    return slot;
+}
 
-    for (int i = iterateFrom; i < MAX_ENTRIES; i++) {
-        file *current = rootDir->files[i];
-        if (strcmp(current->name, "") == 0) return i;
+//adds the directory entry at the given index under its current name
+void nameIndex_insert(nameIndex *index, file **files, int entry) {
+    int slot = nameIndex_slot(index, files, files[entry]->name);
+    index->slots[slot] = entry;
+}
+
+/*
+ * removes the entry with the given name from the name index
+ * the entries probed past it are shifted back into the gap so lookups never need tombstones
+ */
+void nameIndex_remove(nameIndex *index, file **files, const char *name) {
+    int mask = index->capacity - 1;
+    int hole = nameIndex_slot(index, files, name);
+    if (index->slots[hole] == -1) return;
+
+    for (int next = (hole + 1) & mask; index->slots[next] != -1; next = (next + 1) & mask) {
+        int home = nameIndex_hash(files[index->slots[next]]->name) & mask;
+        //an entry can fill the hole if the hole is no further from its home slot than it is now
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            index->slots[hole] = index->slots[next];
+            hole = next;
+        }
     }
-    return ERR;
+    index->slots[hole] = -1;
 }
 
+// extent allocation functions
+
 /*
- * takes in an index value
- * if valid returns the value stored in the FAT at that index
+ * hands back the unused part of a descriptor's reserved extent to the free-block bitmap
+ * reserved blocks stay free in the FAT so nothing reserved is ever written to disk
  */
-char fat_findByIndex(int index) {
-    if (!mounted) return handleError("cannot access FAT of non-mounted file system");
+void fat_releaseReserve(fileSystem *volume, descriptor *desc) {
+    for (int i = 0; i < desc->reserveCount; i++) {
+        freeMap_mark(volume->table->free, desc->reserveStart + i, TRUE);
+    }
+    if (desc->reserveCount > 0 && (volume->table->nextFreeSlot == ERR || desc->reserveStart < volume->table->nextFreeSlot))
+        volume->table->nextFreeSlot = desc->reserveStart;
 
-    if (index > LAST_FAT_INDEX || (index != -1 && index < FIRST_FAT_INDEX))
-        return handleError("fat index out of bounds");
+    desc->reserveStart = -1;
+    desc->reserveCount = 0;
+}
 
-    return table->table[index];
+/*
+ * finds the block a file or directory growing without a descriptor is extended with,
+ * the block straight after its last one if that is free, otherwise the lowest free block
+ */
+int fat_allocateNear(fileSystem *volume, int last) {
+    if (last + 1 < volume->table->entries && freeMap_runLength(volume->table->free, last + 1, 1) == 1) return last + 1;
+    return volume->table->nextFreeSlot;
 }
 
 /*
- * Search the directory struct for a file with a name matching the search
+ * finds the block a growing file should be extended with after its current last block
+ * blocks come from an extent reserved ahead for the descriptor writing the file, so a file's
+ * chain is made of long runs of neighbouring blocks even when several files grow at once
+ * (neighbouring blocks are written as one run at sync and are adjacent in a mapped image)
+ *
+ * once the extent is used up a new one is reserved, straight after the last block if that is
+ * free and otherwise at the first free run of RESERVE_AHEAD_BLOCKS blocks
+ * the block is returned still free in the FAT for the caller to link in, or ERR if the volume is full
  */
-int dir_search(char *name) {
-    for (int i = 0; i < MAX_ENTRIES; i++) {
-        file *current = rootDir->files[i];
-        if (strcmp(current->name, name) == 0) return i; //file at index i is what we are searching for
+int fat_allocateAfter(fileSystem *volume, descriptor *desc, int last) {
+    if (desc == NULL) return fat_allocateNear(volume, last);
+    if (desc->reserveCount > 0 && desc->reserveStart != last + 1) fat_releaseReserve(volume, desc);  //chain moved away from it
+
+    if (desc->reserveCount == 0) {
+        int start = ERR, length = 0;
+        if (last + 1 < volume->table->entries) {
+            length = freeMap_runLength(volume->table->free, last + 1, RESERVE_AHEAD_BLOCKS);
+            if (length > 0) start = last + 1;
+        }
+        if (start == ERR) start = freeMap_findRun(volume->table->free, last + 1, RESERVE_AHEAD_BLOCKS, &length);
+        if (start == ERR) start = freeMap_findRun(volume->table->free, FIRST_FAT_INDEX, RESERVE_AHEAD_BLOCKS, &length);
+        if (start == ERR) return ERR;
+
+        //the extent is taken out of the bitmap so no other allocation can land in it
+        for (int i = 0; i < length; i++) freeMap_mark(volume->table->free, start + i, FALSE);
+        desc->reserveStart = start;
+        desc->reserveCount = length;
+        if (volume->table->nextFreeSlot >= start && volume->table->nextFreeSlot < start + length)
+            volume->table->nextFreeSlot = freeMap_find(volume->table->free, start + length);
     }
-    return ERR; //file with name not found
+
+    int index = desc->reserveStart;
+    desc->reserveStart++;
+    desc->reserveCount--;
+    return index;
 }
 
+// on-disk layout
+
 /*
- * Takes in a value and a block address, if the address is valid
- * writes it directly into the transient struct
- * value = "" can be used to clear
+ * describes where a field of an in memory struct lives on disk
+ * the tables below are the only place the layout of the volume boot record and of a
+ * directory entry is defined, every region is read and written through them
  */
-int writeBlock(int index, char *value) {
-    if (index < FIRST_FAT_INDEX || index > LAST_FAT_INDEX)
-        return handleError("cannot write block - index out of bounds");
-
-    else if (strcpy(storage->blocks[index]->data, value) == NULL)
-        return handleError("cannot write block - writing error");
+typedef struct fieldLayout {
+    size_t structOffset;    //offset of the field in its struct
+    size_t bytes;   //number of bytes the field takes on disk
+}fieldLayout;
+
+static const fieldLayout vbrLayout[] = {
+        {offsetof(volumeBootRecord, fsId), 4},
+        {offsetof(volumeBootRecord, blockSize), 4},
+        {offsetof(volumeBootRecord, maxFiles), 4},
+        {offsetof(volumeBootRecord, blockCount), 4},
+        {offsetof(volumeBootRecord, fatWidth), 4},
+};
+
+static const fieldLayout entryLayout[] = {
+        {offsetof(file, name), FILE_NAME_SIZE},
+        {offsetof(file, fatIndex), 4},
+        {offsetof(file, type), 4},
+        {offsetof(file, size), 8},
+        {offsetof(file, tailIndex), 4},
+        {offsetof(file, tailUsed), 4},
+};
+
+#define FIELD_COUNT(layout) (sizeof(layout) / sizeof(fieldLayout))
+
+//copies each field of a struct to its on-disk position in out
+void serialize(const fieldLayout *layout, int fields, void *from, char *out) {
+    for (int i = 0; i < fields; i++) {
+        memcpy(out, (char *) from + layout[i].structOffset, layout[i].bytes);
+        out += layout[i].bytes;
+    }
+}
 
-    return SUC;
+//copies each field of an on-disk record in to its position in a struct
+void deserialize(const fieldLayout *layout, int fields, char *in, void *to) {
+    for (int i = 0; i < fields; i++) {
+        memcpy((char *) to + layout[i].structOffset, in, layout[i].bytes);
+        in += layout[i].bytes;
+    }
 }
 
 /*
- * Recursively frees all FAT indexes in a chain starting from the given index
- * Also clears the data blocks that they represent
+ * writes an iovec array at the given offset of a file with as few pwritev calls as IOV_MAX allows
+ * returns SUC once every byte is written
  */
-int recursiveFATClear(int index) {
-    //index check
-    if (index < FIRST_FAT_INDEX || index > LAST_FAT_INDEX)
-        return handleError("cannot clear FAT index - index out of bounds");
-
-    else if (table->table[index] == '\0') {  // base case
-        table->table[index] = '0';
-        table->storing--;   //decrease the count of full blocks
-        int res = writeBlock(index, "");
-        if (res == ERR) {
-            table->table[index] = '\0';  //undo deletion on error
-            table->storing++;   //undo count decrease on error
+int pwritevAll(int fd, struct iovec *vectors, int count, off_t offset) {
+    while (count > 0) {
+        int batch = count < IOV_MAX ? count : IOV_MAX;
+        stats_syscall();
+        ssize_t wrote = pwritev(fd, vectors, batch, offset);
+        if (wrote == ERR) return ERR;
+
+        //step over the vectors written, a short write leaves the rest of a vector for the next call
+        offset += wrote;
+        while (count > 0 && (size_t) wrote >= vectors->iov_len) {
+            wrote -= vectors->iov_len;
+            vectors++;
+            count--;
         }
-        if (index < table->nextFreeSlot)
-            table->nextFreeSlot = index; //if removed index lower than lowest free then replace
-        return res;
+        if (count > 0) {
+            vectors->iov_base = (char *) vectors->iov_base + wrote;
+            vectors->iov_len -= wrote;
+        }
+    }
+    return SUC;
+}
 
-    } else {  //recursive case
-        char next = table->table[index]; //take next block address from FAT
-        int res = recursiveFATClear(next);
-        if (res != ERR) {
-            table->table[index] = '0';   //if last was cleared then clear this
-            table->storing--; //decrease the count of taken blocks
-            int wrote = writeBlock(index, "");
-            if (wrote == ERR) {
-                table->table[index] = next;  //undo deletion on error
-                table->storing++;   //undo decrement to full index count on error
-            }
-            if (index < table->nextFreeSlot)
-                table->nextFreeSlot = index; //if removed index lower than lowest free then replace
-            return wrote;
-        } else return ERR;
+/*
+ * writes a buffer at the given offset of a file, continuing after short writes
+ * (a single pwrite moves at most about 2GB so a large region can take several)
+ */
+int pwriteAll(int fd, const char *from, size_t bytes, off_t offset) {
+    while (bytes > 0) {
+        stats_syscall();
+        ssize_t wrote = pwrite(fd, from, bytes, offset);
+        if (wrote == ERR) return ERR;
+        from += wrote;
+        bytes -= wrote;
+        offset += wrote;
     }
+    return SUC;
 }
 
 /*
- * Takes in a file name and checks the open file descriptors
- * if there is at least one open file descriptor for the name then it
- * is open  and the function returns true, otherwise returns false
+ * reads a buffer from the given offset of a file, continuing after short reads
+ * returns ERR with errno as ENODATA if the file ends before the buffer is full
  */
-int fileIsOpen(char *name) {
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        descriptor *current = fds[i];
-        if (current != NULL) {
-            char *check = current->represents->name;
-            if (strcmp(check, name) == 0) return TRUE;
+int preadAll(int fd, char *to, size_t bytes, off_t offset) {
+    while (bytes > 0) {
+        stats_syscall();
+        ssize_t got = pread(fd, to, bytes, offset);
+        if (got == ERR) return ERR;
+        if (got == 0) {
+            errno = ENODATA;
+            return ERR;
         }
+        to += got;
+        bytes -= got;
+        offset += got;
     }
-    return FALSE;
+    return SUC;
 }
 
 /*
- * goes through the array of open file descriptors and adds
- * the newly created one returning it's index
- * if there is no space returns error
- *
- * if the file already exists and is open for writing then
- * any request to open it again for writing is disallowed
+ * fills an iovec array from the given offset of a file with as few preadv calls as IOV_MAX allows
+ * returns ERR with errno as ENODATA if the file ends before every vector is full
  */
-int addDescriptor(descriptor *toAdd) {
-    int forWrite = (toAdd->mode == O_WRONLY);
-    char *toAddName = toAdd->represents->name;
-    int insertIndex = -1;
+int preadvAll(int fd, struct iovec *vectors, int count, off_t offset) {
+    while (count > 0) {
+        int batch = count < IOV_MAX ? count : IOV_MAX;
+        stats_syscall();
+        ssize_t got = preadv(fd, vectors, batch, offset);
+        if (got == ERR) return ERR;
+        if (got == 0) {
+            errno = ENODATA;
+            return ERR;
+        }
 
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        descriptor *current = fds[i];
-        if (current == NULL) {   //replace insert with the first instance of a NULL entry
-            if (insertIndex == -1) insertIndex = i;
+        //step over the vectors filled, a short read leaves the rest of a vector for the next call
+        offset += got;
+        while (count > 0 && (size_t) got >= vectors->iov_len) {
+            got -= vectors->iov_len;
+            vectors++;
+            count--;
+        }
+        if (count > 0) {
+            vectors->iov_base = (char *) vectors->iov_base + got;
+            vectors->iov_len -= got;
         }
-            // prevents two instances of a file being opened for writing
-        else if ((strcmp(current->represents->name, toAddName) == 0) && current->mode == O_WRONLY && forWrite)
-            return handleError("cannot open file - only one instance of a file can be open for writing at once");
-    }
-    if (insertIndex != ERR) {
-        fds[insertIndex] = toAdd;
-        return insertIndex;  //if it was added return the fd
     }
+    return SUC;
+}
 
-    return handleError("cannot open file - max open file descriptors reached");
+//rounds an offset up to the next multiple of REGION_ALIGN
+off_t alignRegion(off_t offset) {
+    return (offset + REGION_ALIGN - 1) / REGION_ALIGN * REGION_ALIGN;
 }
 
 /*
- * function for overwriting a file
- * Takes in the name of the file to overwrite
- * if it does not exist then throws an error (this should not occur it exists to prevent misuse)
- * Otherwise it checks if the file is open and if so will throw an error as open files cannot be
- * overwritten (with this method due to the affect it would have on file descriptors)
- * If the file exits but is not open then it will be cleared and replaced with an empty file
- * of the same name
+ * works out where each region of an image lives from its volume boot record
+ * the FAT follows the record, the directory follows the FAT and the data region follows the directory
+ * each region starts aligned so that a mapped image can use its entries in place
  */
-int overwriteFile(char *name) {
-    int changeIndex = dir_search(name);
-    if (changeIndex == ERR) return handleError("cannot overwrite file - file does not exists");
-    if (fileIsOpen(name))
-        return handleError(
-                "cannot create file - file exists and cannot be overwritten: has at least one open file descriptor ");
-
-
-    file *toChange = rootDir->files[changeIndex];
-    int fatIndex = toChange->fatIndex;
-    recursiveFATClear(fatIndex);
-    rootDir->files[changeIndex] = new_file(name, fatIndex, 0);
+void computeLayout(volumeBootRecord *record, regionLayout *out) {
+    out->fatSize = (size_t) record->blockCount * (record->fatWidth / 8);
+    out->dirSize = (size_t) record->maxFiles * FILE_ENTRY_SIZE;
+    out->dataSize = (size_t) record->blockCount * record->blockSize;
+    out->dirOffset = alignRegion(FAT_REGION_OFST + out->fatSize);
+    out->dataOffset = alignRegion(out->dirOffset + out->dirSize);
+    out->imageSize = out->dataOffset + out->dataSize;
+}
 
-    //create file descriptor for opened file and find int representation
-    off_t fileDataLocation = DATA_REGION_OFST + (changeIndex * BLOCK_SIZE); //data region + blocks move past to start
-    descriptor *desc = new_descriptor(toChange, O_WRONLY, fileDataLocation);
+/*
+ * checks a volume boot record describes a geometry this engine can use
+ * returns SUC if it does, otherwise ERR with a message naming the bad value
+ */
+int checkGeometry(volumeBootRecord *record) {
+    if (record->fsId != IDENT) return handleError("invalid Identifier");
+    if (record->blockSize < 1) return handleError("invalid geometry - block size must be positive");
+    if (record->fatWidth == FAT_WIDTH_8) {
+        if (record->blockCount <= FIRST_FAT_INDEX || record->blockCount > MAX_FAT8_ENTRIES)
+            return handleError("invalid geometry - block count out of range for a FAT-8 table");
+    } else if (record->fatWidth == FAT_WIDTH_32) {
+        if (record->blockCount <= FIRST_FAT_INDEX || record->blockCount > MAX_FAT32_ENTRIES)
+            return handleError("invalid geometry - block count out of range for a FAT-32 table");
+    } else return handleError("invalid geometry - unknown FAT width");
+    if (record->maxFiles < 1) return handleError("invalid geometry - directory must hold at least one file");
+    return SUC;
+}
+
+/*
+ * write the data of the volume boot record to a given file
+ * the record is serialized and written with a single positional write
+ * returns 1 on success and -1 on failure
+ * the record written is the given volume's
+*/
+int writeVolumeBootRecord(fileSystem *volume, int fd) {
+    char record[VOLUME_RECORD_SIZE];
+    serialize(vbrLayout, FIELD_COUNT(vbrLayout), volume->vmb, record);
+
+    stats_syscall();
+    if (pwrite(fd, record, VOLUME_RECORD_SIZE, VOLUME_RECORD_OFST) == ERR)
+        return handleError_p("writeVolumeBootRecord - could not write record");
+
+    return SUC;
+}
+
+/*
+ * write the changed chunks of the File Allocation Table to a given file
+ * each run of neighbouring dirty chunks is contiguous in memory so goes out in one positional write,
+ * the clean chunks between runs are not written
+ * returns 1 on success and -1 on failure
+ * the table written is the given volume's
+*/
+int writeFAT(fileSystem *volume, int fd) {
+    int position = 0, start, length;
+
+    while (nextDirtyRun(volume->table->dirty, &position, &start, &length)) {
+        size_t first = (size_t) start * FAT_SYNC_CHUNK;
+        size_t bytes = (size_t) length * FAT_SYNC_CHUNK;
+        if (first + bytes > volume->layout.fatSize) bytes = volume->layout.fatSize - first;   //last chunk may be partial
+
+        if (pwriteAll(fd, (char *) volume->table->table + first, bytes, FAT_REGION_OFST + first) == ERR)
+            return handleError_p("writeFAT - couldn't write table");
+    }
+
+    return SUC;
+}
+
+/*
+ * write the changed entries of the root (only) directory to a given file
+ * the dirty entries are serialized into one buffer and each run of neighbouring ones
+ * is written with positional writes, continuing after short writes
+ * returns 1 on success and -1 on failure
+ * the directory written is the given volume's
+*/
+int writeDir(fileSystem *volume, int fd) {
+    dirtySet *dirty = volume->dir->dirty;
+    if (dirty->count == 0) return SUC;
+
+    char *buffer = malloc((size_t) dirty->count * FILE_ENTRY_SIZE);
+    if (buffer == NULL) return handleError("writeDir - could not allocate entry buffer");
+
+    int position = 0, start, length;
+    char *run = buffer;
+    while (nextDirtyRun(dirty, &position, &start, &length)) {
+        for (int i = 0; i < length; i++) {
+            serialize(entryLayout, FIELD_COUNT(entryLayout), volume->dir->files[start + i], run + ((size_t) i * FILE_ENTRY_SIZE));
+        }
+
+        size_t bytes = (size_t) length * FILE_ENTRY_SIZE;
+        if (pwriteAll(fd, run, bytes, volume->layout.dirOffset + ((off_t) start * FILE_ENTRY_SIZE)) == ERR) {
+            free(buffer);
+            return handleError_p("writeDir - could not write entries");
+        }
+        run += bytes;
+    }
+    free(buffer);
+
+    return SUC;
+}
+
+/*
+ * write the changed blocks of the data region to a given file
+ * each run of neighbouring dirty blocks is gathered into one pwritev
+ * returns 1 on success and -1 on failure
+ * the region written is the given volume's
+*/
+int writeDataRegion(fileSystem *volume, int fd) {
+    int position = 0, start, length;
+
+    while (nextDirtyRun(volume->storage->dirty, &position, &start, &length)) {
+        struct iovec *vectors = malloc(length * sizeof(struct iovec));
+        if (vectors == NULL) return handleError("writeDataRegion - could not allocate block vectors");
+
+        for (int i = 0; i < length; i++) {
+            vectors[i].iov_base = volume->storage->blocks[start + i]->data;
+            vectors[i].iov_len = volume->storage->blockSize;
+        }
+
+        int res = pwritevAll(fd, vectors, length, volume->layout.dataOffset + ((off_t) start * volume->storage->blockSize));
+        free(vectors);
+        if (res == ERR) return handleError_p("writeDataRegion - could not write blocks");
+    }
+
+    return SUC;
+}
+
+//the FAT width an image of the given number of blocks is given
+int fatWidthFor(int blockCount) {
+    //the narrow table is kept for volumes it can index, anything larger gets 32 bit indexes
+    return blockCount <= MAX_FAT8_ENTRIES ? FAT_WIDTH_8 : FAT_WIDTH_32;
+}
+
+/*
+ * sets up the regions of an empty image in the given volume, nothing is written
+ * VMB starts with the given geometry
+ * The FAT is initialised as completely free
+ * The directory is initialised with a set of empty file entries
+ */
+int initialise_regions(fileSystem *volume, int blockSize, int blockCount, int maxFiles) {
+    int fatWidth = fatWidthFor(blockCount);
+
+    volume->vmb = new_VBR(blockSize, blockCount, maxFiles, fatWidth);
+    if (volume->vmb == NULL) return ERR;
+    if (checkGeometry(volume->vmb) == ERR) return ERR;
+    computeLayout(volume->vmb, &volume->layout);
+
+    volume->table = new_FAT(blockCount, fatWidth);
+    if (volume->table == NULL) return ERR;
+
+    volume->dir = new_rootDir(maxFiles);
+    if (volume->dir == NULL) return ERR;
+
+    return SUC;
+}
+
+/*
+ * writes the volume boot record, FAT and directory of the given volume to a new image
+ * nothing is on disk yet so all of the FAT and directory is dirty
+ * the file is sized to hold the data region without the region being written here
+ */
+int write_regions(fileSystem *volume, int fd) {
+    if (writeVolumeBootRecord(volume, fd) == ERR) return ERR;
+
+    markAllDirty(volume->table->dirty);
+    if (writeFAT(volume, fd) == ERR) return ERR;
+
+    markAllDirty(volume->dir->dirty);
+    if (writeDir(volume, fd) == ERR) return ERR;
+
+    stats_syscall();
+    if (ftruncate(fd, volume->layout.imageSize) == ERR) return handleError_p("write_regions - could not size data region");
+
+    return SUC;
+}
+
+/*
+ * Initialises the File System with default data
+ * the regions of an empty image (see initialise_regions) are written to the new file
+ * The data region is left as the zeroed tail of the file, which reads back as empty blocks
+ */
+int initialise_fs(fileSystem *volume, int fd, int blockSize, int blockCount, int maxFiles) {
+    if (initialise_regions(volume, blockSize, blockCount, maxFiles) == ERR) return ERR;
+
+    return write_regions(volume, fd);
+}
+
+/*
+ * When a file system is created it:
+ *  - creates a file with the given name to save persistent data -using create_fs
+ *  - opens that file
+ *  - creates the volume boot record and writes that data to the file
+ *  - creates the fat table and writes that data to the file (at it's offset)
+ *  - closes the file
+ *
+ * the geometry is recorded in the volume boot record so mount sizes everything from it
+ * (DEFAULT_BLOCK_SIZE, DEFAULT_BLOCK_COUNT and DEFAULT_MAX_ENTRIES give the original geometry)
+ */
+int make_fs(char *store_name, int blockSize, int blockCount, int maxFiles) {
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    int mode = 0777;
+
+    stats_syscall();
+    int fd = open(store_name, flags, mode);
+
+    if (fd <= 0) return handleError_p("make_fs - could not create or open store file");
+    else {
+
+        //the empty image is built in a volume of its own, which is only needed to write it
+        fileSystem *building = new_fileSystem(NULL, NULL, NULL, NULL);
+        if (building == NULL) {
+            stats_syscall();
+            close(fd);
+            return handleError("make_fs - could not allocate volume");
+        }
+
+        int res = initialise_fs(building, fd, blockSize, blockCount, maxFiles);
+
+        free_fileSystem(building);
+        stats_syscall();
+        close(fd);
+        return res;
+    }
+}
+
+/*
+ * reads the volume boot record of the given disk file into record, failing if the file ends before it
+ */
+int readVolumeBootRecord(int fd, volumeBootRecord *record) {
+    char raw[VOLUME_RECORD_SIZE] = {0};
+    if (preadAll(fd, raw, VOLUME_RECORD_SIZE, VOLUME_RECORD_OFST) == ERR)
+        return handleError_p("readVolumeBootRecord - could not read record");
+
+    deserialize(vbrLayout, FIELD_COUNT(vbrLayout), raw, record);
+    return SUC;
+}
+
+/*
+ * function for loading the data from the "disk" file into transient storage (struct)
+ * checks the file system is mounted
+ * then reads the contents of the volume boot record into the vmb struct
+ * if vmb is not initialised then it will initialise it
+ */
+int load_volumeBoot(fileSystem *volume) {
+    if (!volume->mounted) return handleError("load_volumeBoot - file system not mounted");
+
+    if (volume->vmb == NULL) volume->vmb = new_VBR(0, 0, 0, 0);   //the geometry is filled in from disk
+    if (volume->vmb == NULL) return handleError("load_volumeBoot - could not create volume boot record");
+
+    return readVolumeBootRecord(volume->filedes, volume->vmb);
+}
+
+/*
+ * Loads the value of the FAT stored on "disk" to the in memory struct
+ * when the image is mapped the struct is a view onto the mapped FAT instead,
+ * either way the table is then scanned once to build the free-block bitmap,
+ * which gives the first free index and the number of full ones
+ */
+int load_fat(fileSystem *volume) {
+    if (!volume->mounted) return handleError("load_fat - file system not mounted");
+
+    if (volume->image != NULL) {
+        if (volume->table == NULL) volume->table = new_FAT_view(volume->image + FAT_REGION_OFST, volume->vmb->blockCount, volume->vmb->fatWidth);
+        if (volume->table == NULL) return handleError("load_fat - could not create FAT view");
+    } else {
+        if (volume->table == NULL) volume->table = new_FAT(volume->vmb->blockCount, volume->vmb->fatWidth);
+        if (volume->table == NULL) return handleError("load_fat - could not create FAT");
+
+        //the whole table is read straight into its buffer
+        if (preadAll(volume->filedes, volume->table->table, volume->layout.fatSize, FAT_REGION_OFST) == ERR)
+            return handleError_p("load_fat - cannot read table");
+    }
+
+    //each word of the bitmap is assembled before it is stored so the scan touches it once
+    freeMap *map = volume->table->free;
+    int freeCount = 0;
+    for (int word = 0; word < map->wordCount; word++) {
+        uint64_t bits = 0;
+        int first = word * MAP_WORD_BITS;
+        int last = first + MAP_WORD_BITS < volume->table->entries ? first + MAP_WORD_BITS : volume->table->entries;
+        for (int i = first; i < last; i++) {
+            if (fat_get(volume, i) == FAT_FREE) bits |= (uint64_t) 1 << (i - first);
+        }
+        map->words[word] = bits;
+        if (bits != 0) map->summary[word / MAP_WORD_BITS] |= (uint64_t) 1 << (word % MAP_WORD_BITS);
+        freeCount += __builtin_popcountll(bits);
+    }
+
+    volume->table->storing = volume->table->entries - freeCount;
+    volume->table->nextFreeSlot = freeMap_find(map, FIRST_FAT_INDEX);  //stays as -1 (ERR) if there is no free index
+
+    return SUC;
+}
+
+/*
+ * points the transient directory struct at the entries of the mapped image
+ * then counts the stored files and finds the first free slot
+ */
+int load_directoryView(fileSystem *volume) {
+    if (volume->dir == NULL) volume->dir = new_rootDir_view(volume->image + volume->layout.dirOffset, volume->vmb->maxFiles);
+    if (volume->dir == NULL) return handleError("load_directory - could not create directory view");
+
+    for (int i = 0; i < volume->dir->capacity; i++) {
+        if (volume->dir->files[i]->name[0] != '\0') {
+            volume->dir->storing++;
+            nameIndex_insert(volume->dir->index, volume->dir->files, i);
+        }
+        else if (volume->dir->nextFreeSlot == -1 || volume->dir->nextFreeSlot > i) volume->dir->nextFreeSlot = i;
+    }
+
+    return SUC;
+}
+
+/*
+ * stores the directory data on the "disk" file into the transient struct
+ * the whole directory region is read into one buffer then split into its entries
+ */
+int load_directory(fileSystem *volume) {
+    if (!volume->mounted) return handleError("load_directory - file system not mounted");
+
+    if (volume->image != NULL) return load_directoryView(volume);
+
+    if (volume->dir == NULL) volume->dir = new_rootDir(volume->vmb->maxFiles);
+    if (volume->dir == NULL) return handleError("load_directory - could not create directory");
+
+    char *raw = calloc(1, volume->layout.dirSize);
+    if (raw == NULL) return handleError("load_directory - could not allocate directory buffer");
+    if (preadAll(volume->filedes, raw, volume->layout.dirSize, volume->layout.dirOffset) == ERR) {
+        free(raw);
+        return handleError_p("load_directory - cannot read directory");
+    }
+
+    for (int i = 0; i < volume->dir->capacity; i++) {
+        file *insert = volume->dir->files[i];
+        deserialize(entryLayout, FIELD_COUNT(entryLayout), raw + (i * FILE_ENTRY_SIZE), insert);
+
+        //if the file exists (non-default struct) then increase the storage count
+        //otherwise check to see if a new firstFreeINdex should be assigned
+        if (strcmp(insert->name, "") != 0) {
+            volume->dir->storing++;
+            nameIndex_insert(volume->dir->index, volume->dir->files, i);
+        }
+        else if (volume->dir->nextFreeSlot == -1 || volume->dir->nextFreeSlot > i) volume->dir->nextFreeSlot = i;
+
+    }
+    free(raw);
+
+    return SUC;
+}
+
+/*
+ * Loads the data from the "disk" file's data region to the transient in memory structs
+ * or when the image is mapped points the struct's blocks at the mapped data region
+ */
+int load_dataRegion(fileSystem *volume) {
+    if (!volume->mounted) return handleError("load_dataRegion - file system not mounted");
+
+    //a mapped image needs no reads, each block is a view into the mapping
+    if (volume->image != NULL) {
+        if (volume->storage == NULL) volume->storage = new_dataRegion_view(volume->image + volume->layout.dataOffset, volume->vmb->blockCount, volume->vmb->blockSize);
+        if (volume->storage == NULL) return handleError("load_dataRegion - could not create data region view");
+        return SUC;
+    }
+
+    if (volume->storage == NULL) volume->storage = new_dataRegion(volume->vmb->blockCount, volume->vmb->blockSize);
+    if (volume->storage == NULL) return handleError("load_dataRegion - could not create data region");
+
+    //scatter the region straight into the blocks, IOV_MAX blocks per preadv
+    struct iovec vectors[IOV_MAX];
+    for (int first = 0; first < volume->storage->count; first += IOV_MAX) {
+        int count = volume->storage->count - first < IOV_MAX ? volume->storage->count - first : IOV_MAX;
+        for (int i = 0; i < count; i++) {
+            vectors[i].iov_base = volume->storage->blocks[first + i]->data;
+            vectors[i].iov_len = volume->storage->blockSize;
+        }
+        if (preadvAll(volume->filedes, vectors, count, volume->layout.dataOffset + ((off_t) first * volume->storage->blockSize)) == ERR)
+            return handleError_p("load_dataRegion - couldn't read blocks");
+    }
+
+    return SUC;
+}
+
+/*
+ * maps the whole disk file into memory so the FAT, directory and data region
+ * structs can be views into it rather than copies
+ * an image shorter than its volume boot record says is refused, as a buffered mount refuses it
+ */
+int map_image(fileSystem *volume) {
+    struct stat info;
+    stats_syscall();
+    if (fstat(volume->filedes, &info) == ERR) return handleError_p("map_image - could not stat disk file");
+    if ((size_t) info.st_size < volume->layout.imageSize) return handleError("map_image - disk file is shorter than its volume");
+
+    stats_syscall();
+    void *mapping = mmap(NULL, volume->layout.imageSize, PROT_READ | PROT_WRITE, MAP_SHARED, volume->filedes, 0);
+    if (mapping == MAP_FAILED) return handleError_p("map_image - could not map disk file");
+
+    volume->image = mapping;
+    return SUC;
+}
+
+/*
+ *  Function for setting the given volume's structs to represent the in memory data
+ *  calls all the other load functions, each of which fills in its part of the volume
+ *  then returns 0 (or -1 if it fails at any point)
+ */
+int load_fileSystem(fileSystem *volume) {
+    if (!volume->mounted) return handleError("load_fileSystem - file system not mounted");
+
+    if (load_volumeBoot(volume) == ERR) return ERR;
+    if (load_fat(volume) == ERR) return ERR;
+    if (load_directory(volume) == ERR) return ERR;
+    if (load_dataRegion(volume) == ERR) return ERR;
+
+    return SUC;
+}
+
+/*
+ * flushes the pages of the mapped image holding the given byte range
+ * msync needs a page aligned address so the range is widened to whole pages
+ * only the pages that are dirty are written, however long the range
+ */
+int flushMappedRange(fileSystem *volume, off_t offset, size_t length) {
+    long page = sysconf(_SC_PAGESIZE);
+    off_t first = (offset / page) * page;
+
+    stats_flush();
+    if (msync(volume->image + first, length + (offset - first), MS_SYNC) == ERR)
+        return handleError_p("flushMappedRange - could not flush mapped image");
+    return SUC;
+}
+
+/*
+ * body of the group commit thread
+ * sleeps until a sync asks for a commit, then waits out the commit window so that every
+ * sync made within it is covered by the same fdatasync of the image
+ * the flush covers every generation requested before it starts, those syncs are woken once it is done
+ */
+void *commitLoop(void *arg) {
+    fileSystem *volume = arg;   //the thread works for the volume that started it
+    pthread_mutex_lock(&volume->commitLock);
+    while (volume->committerRunning) {
+        while (volume->commitFlushed == volume->commitRequested && volume->committerRunning)
+            pthread_cond_wait(&volume->commitWake, &volume->commitLock);
+        if (!volume->committerRunning) break;
+
+        //let the window fill with other syncs before flushing them together
+        useconds_t window = volume->commitWindow;
+        pthread_mutex_unlock(&volume->commitLock);
+        usleep(window);
+        pthread_mutex_lock(&volume->commitLock);
+
+        uint64_t covered = volume->commitRequested; //syncs arriving during the flush wait for the next one
+        pthread_mutex_unlock(&volume->commitLock);
+        stats_flush();
+        int flushed = fdatasync(volume->filedes);
+        if (flushed == ERR) handleError_p("commitLoop - could not flush image");
+        pthread_mutex_lock(&volume->commitLock);
+
+        if (flushed == ERR) volume->commitFailed = TRUE;
+        volume->commitFlushed = covered;
+        pthread_cond_broadcast(&volume->commitDone);
+    }
+    pthread_mutex_unlock(&volume->commitLock);
+    return NULL;
+}
+
+//starts the group commit thread for a DURABLE_GROUP mount
+int startCommitter(fileSystem *volume) {
+    volume->committerRunning = TRUE;
+    volume->commitRequested = 0;
+    volume->commitFlushed = 0;
+    if (pthread_create(&volume->committer, NULL, commitLoop, volume) != 0) {
+        volume->committerRunning = FALSE;
+        return handleError("startCommitter - could not start group commit thread");
+    }
+    return SUC;
+}
+
+/*
+ * stops the group commit thread
+ * un-mount holds the volume exclusively by then so no sync is waiting on a commit,
+ * anything still requested is flushed straight away so nothing synced is left behind
+ */
+int stopCommitter(fileSystem *volume) {
+    pthread_mutex_lock(&volume->commitLock);
+    volume->committerRunning = FALSE;
+    pthread_cond_signal(&volume->commitWake);
+    pthread_mutex_unlock(&volume->commitLock);
+    pthread_join(volume->committer, NULL);
+
+    if (volume->commitFlushed != volume->commitRequested) {
+        volume->commitFlushed = volume->commitRequested;
+        stats_flush();
+        if (fdatasync(volume->filedes) == ERR) return handleError_p("stopCommitter - could not flush image");
+    }
+    return SUC;
+}
+
+/*
+ * hands the writes of a sync to the group commit thread and waits for the flush that covers them
+ * each request takes the next generation, and a flush covers every generation requested before it starts
+ * returns ERR if that flush failed, as does every later commit: once a flush has failed there is
+ * no knowing which of the pages it was writing ever reached the disk
+ */
+int requestCommit(fileSystem *volume) {
+    pthread_mutex_lock(&volume->commitLock);
+    uint64_t generation = ++volume->commitRequested;
+    pthread_cond_signal(&volume->commitWake);
+    while (volume->commitFlushed < generation) pthread_cond_wait(&volume->commitDone, &volume->commitLock);
+    int failed = volume->commitFailed;
+    pthread_mutex_unlock(&volume->commitLock);
+
+    if (failed) return handleError("requestCommit - group commit could not flush image");
+    return SUC;
+}
+
+/*
+ * makes the writes of a sync durable according to the durability chosen at mount
+ * only the image's own file is flushed, never the whole host
+ * every flush covers all of the image's dirty pages rather than just those of its own sync,
+ * so a sync that finds its changes already written by another one is still only durable once they are
+ */
+int makeDurable(fileSystem *volume) {
+    switch (volume->durability) {
+        case DURABLE_NONE:
+            return SUC;
+
+        case DURABLE_DATA:
+            if (volume->image != NULL) return flushMappedRange(volume, 0, volume->layout.imageSize);
+            stats_flush();
+            if (fdatasync(volume->filedes) == ERR) return handleError_p("makeDurable - could not flush image data");
+            return SUC;
+
+        case DURABLE_GROUP:
+            return requestCommit(volume);
+
+        default:
+            stats_flush();
+            if (fsync(volume->filedes) == ERR) return handleError_p("makeDurable - could not flush image");
+            return SUC;
+    }
+}
+
+/*
+ * writes the transient data in the structs to the
+ * hard memory in the file
+ * meaning that all data represented in the
+ * file corresponds to the process data
+ *
+ * only the FAT chunks, directory entries and blocks marked dirty since the last sync
+ * are written, so the cost follows the amount of change rather than the size of the volume
+ * the volume boot record never changes after make_fs so is never rewritten
+ * a mapped image already holds every change so it only has its dirty sets emptied
+ *
+ * the caller holds the metadata lock, the writes are made durable by sync_flush
+ * once it is dropped, so other calls are not held up by the flush
+ * writers copy into their blocks holding the data lock shared, so it is taken exclusively while blocks are written out,
+ * as writers take the metadata lock inside the data lock the metadata lock is let go and taken again around it
+ * returns Success if everything is written otherwise returns an error
+ */
+int sync_write(fileSystem *volume, pendingSync *pending) {
+    pending->start = stats_start();
+    if (!volume->mounted) return stats_done(STATS_SYNC, pending->start, handleError("cannot sync file system - file system has not been mounted"));
+
+    //a mapped image is written in place so only the flush is needed
+    if (volume->image == NULL) {
+        pthread_mutex_unlock(&volume->metaLock);
+        pthread_rwlock_wrlock(&volume->dataLock);
+        pthread_mutex_lock(&volume->metaLock);
+
+        sortDirty(volume->table->dirty);
+        sortDirty(volume->dir->dirty);
+        sortDirty(volume->storage->dirty);
+
+        char *failed = NULL;
+        if (writeFAT(volume, volume->filedes) == ERR) failed = "cannot sync file system - could not sync FAT";
+        else if (writeDir(volume, volume->filedes) == ERR) failed = "cannot sync file system - could not sync directory";
+        else if (writeDataRegion(volume, volume->filedes) == ERR) failed = "cannot sync file system - could not sync data region";
+        pthread_rwlock_unlock(&volume->dataLock);
+        if (failed != NULL) return stats_done(STATS_SYNC, pending->start, handleError(failed));
+    }
+
+    //everything listed is now in the image, it only has to be flushed
+    clearDirty(volume->table->dirty);
+    clearDirty(volume->dir->dirty);
+    clearDirty(volume->storage->dirty);
+
+    pending->written = TRUE;
+    return SUC;
+}
+
+/*
+ * makes the writes of a sync durable as chosen at mount (see makeDurable), with no lock but the volume lock held
+ * does nothing if sync_write did not write anything
+ * returns Success once the writes are durable otherwise returns an error
+ */
+int sync_flush(fileSystem *volume, pendingSync *pending) {
+    if (!pending->written) return SUC;
+    pending->written = FALSE;
+
+    if (makeDurable(volume) == ERR) return stats_done(STATS_SYNC, pending->start, handleError("cannot sync file system - could not flush image"));
+    return stats_done(STATS_SYNC, pending->start, SUC);
+}
+
+//writes and flushes a sync in one go, for a caller holding the volume exclusively
+int fs_sync(fileSystem *volume) {
+    pendingSync pending = {FALSE, 0};
+    pthread_mutex_lock(&volume->metaLock);
+    int result = sync_write(volume, &pending);
+    pthread_mutex_unlock(&volume->metaLock);
+    if (result == ERR) return ERR;
+    return sync_flush(volume, &pending);
+}
+
+/*
+ * drops the metadata lock then makes durable any sync written under it
+ * the volume lock is held until the flush is done so the volume cannot be un-mounted under it
+ * returns result, or ERR if the flush fails
+ */
+int meta_unlockSync(fileSystem *volume, int result, pendingSync *pending) {
+    pthread_mutex_unlock(&volume->metaLock);
+    if (sync_flush(volume, pending) == ERR) result = ERR;
+    volume_unlock(volume);
+    return result;
+}
+
+/*
+ * checks the file system is mounted and the specified file is open
+ * then takes the file descriptor out of the descriptor table, once no other call is using it, and frees it
+ * then, if it was open for writing, syncs the updated file to memory, flushing it once the locks are dropped
+ * (a reader changed nothing so closing one does no io)
+ * the caller holds the volume lock, the metadata lock is only taken once the descriptor is detached
+ *
+ * if all checks pass returns 0 else returns -1
+ */
+int closeFile(fileSystem *volume, int fd) {
+    if (!volume->mounted) return handleError("cannot close file - file system is not mounted");
+    descriptor *desc = desc_detach(volume, fd);
+    if (desc == NULL) return ERR;
+
+    pthread_mutex_lock(&volume->metaLock);
+
+    //remove the file descriptor, any blocks it held for the file to grow into are free again
+    int wrote = desc->mode == O_WRONLY;
+    dentry *state = desc->node;
+    state->descriptors--;
+    if (wrote) state->writing = FALSE;
+    fat_releaseReserve(volume, desc);
+    free_descriptor(volume->descriptorPool, desc);
+
+    //the sync is written out under the lock and flushed once it is dropped
+    pendingSync pending = {FALSE, 0};
+    int result = SUC;
+    if (wrote && sync_write(volume, &pending) == ERR) result = handleError("could not sync file");
+    pthread_mutex_unlock(&volume->metaLock);
+
+    if (sync_flush(volume, &pending) == ERR) result = handleError("could not sync file");
+    return result;
+}
+
+//runs closeFile with the volume locked, the close waits for any call still using the descriptor to finish
+int fs_close(fileSystem *volume, int fd) {
+    uint64_t start = stats_start();
+    if (volume_check(volume) == ERR) return stats_done(STATS_CLOSE, start, ERR);
+    volume_lock(volume, FALSE);
+    int result = closeFile(volume, fd);
+    volume_unlock(volume);
+    return stats_done(STATS_CLOSE, start, result);
+}
+
+/*
+ * Mounts an existing file system
+ * this allows it's data to be read and edited
+ * it does this by:
+ * - attempting to open the file
+ * - reading the volume boot record
+ * - isolating the initial value
+ * - comparing it to the stored ident int
+ * - if successfully mounted call the load functions to initialise the structs
+ * - if one fails un-mount the system
+ * (for now just return -1 and set values but after unmount is initialised then can use it)]
+ *
+ * with MOUNT_MMAP the image is mapped once and the structs become views into it
+ * so mounting costs a constant number of syscalls whatever the number of blocks
+ *
+ * the durability part of the flags decides how every later sync flushes the image
+ */
+int mountImage(fileSystem *volume, char *store_name, int mountFlags) {
+    int mode = mountFlags & MOUNT_MODE_MASK;
+    if (mode != MOUNT_BUFFERED && mode != MOUNT_MMAP) return handleError("mount_fs - invalid mount mode");
+    if (mountFlags & ~(MOUNT_MODE_MASK | DURABILITY_MASK)) return handleError("mount_fs - invalid mount flags");
+    if (volume->mounted) return handleError("mount_fs - a file system is already mounted");
+
+    //anything set up before a failure is undone when the volume is released (see releaseVolume)
+    int flags = O_RDWR;
+    stats_syscall();
+    volume->filedes = open(store_name, flags);
+    if (volume->filedes == ERR) return handleError_p("mount_fs - cannot open file");
+
+    volumeBootRecord record;
+    if (readVolumeBootRecord(volume->filedes, &record) == ERR) return handleError("mount_fs - could not read boot record");
+
+    //check the file has a matching identifier and a usable geometry, everything else is sized from it
+    if (checkGeometry(&record) == ERR) return handleError("mount_fs - invalid volume boot record");
+    computeLayout(&record, &volume->layout);
+
+    volume->fds = new_descriptorTable();
+    volume->dcache = new_dentryCache(DENTRY_CACHE_BUCKETS);
+    volume->rootNode = new_dentry(volume->dentryPool, "", NULL, -1, NULL, FALSE);
+    if (volume->fds == NULL || volume->dcache == NULL || volume->rootNode == NULL)
+        return handleError("mount_fs - could not allocate descriptor table");
+
+    //assign volume variables
+    volume->mounted = TRUE;
+    volume->durability = mountFlags & DURABILITY_MASK;
+
+    if (mode == MOUNT_MMAP && map_image(volume) == ERR) return ERR;
+
+    //load the disk memory into transient storage
+    if (load_fileSystem(volume) == ERR) return handleError("mount_fs - could not load file system");
+
+    if (volume->durability == DURABLE_GROUP && startCommitter(volume) == ERR) return ERR;
+
+    return SUC;
+}
+
+//frees a volume's structs and lets go of its image, once it is un-mounted or when mounting it fails
+void releaseVolume(fileSystem *volume) {
+    char *image = volume->image;
+    size_t imageSize = volume->layout.imageSize;
+    int filedes = volume->filedes;
+
+    free_fileSystem(volume);
+
+    //views are gone so the image can be unmapped
+    if (image != NULL) {
+        stats_syscall();
+        if (munmap(image, imageSize) == ERR) handleError_p("releaseVolume - could not unmap file system");
+    }
+    if (filedes >= 0) {
+        stats_syscall();
+        close(filedes);
+    }
+}
+
+/*
+ * mounts the image in the given file as a new volume and returns its handle, or NULL if it cannot be mounted
+ * each volume has its own descriptor table and caches so any number can be mounted at once
+ * no other call can hold the handle until it is returned so the mount itself needs no lock
+ */
+fileSystem *mount_fs(char *store_name, int mountFlags) {
+    fileSystem *volume = new_fileSystem(NULL, NULL, NULL, NULL);
+    if (volume == NULL) {
+        handleError("mount_fs - could not allocate volume");
+        return NULL;
+    }
+
+    if (mountImage(volume, store_name, mountFlags) == ERR) {
+        releaseVolume(volume);
+        return NULL;
+    }
+    return volume;
+}
+
+/*
+ * This function syncs the process structs (transient data)
+ * with the hard file data meaning that all changes made to the file
+ * using the structs will be written back to the file
+ *
+ * if syncing fails so will mount
+ * otherwise mount will then close any open file descriptors
+ * then close the underlying hard disk file
+ * final step is to mark the volume un-mounted, umount_fs then frees it
+ * if all operations succeed it will return 0
+ * otherwise it will return -1 and a relevant message
+ */
+int unmountImage(fileSystem *volume) {
+    //the blocks of a view would be freed under it
+    for (int i = 0; i < volume->fds->slots; i++) {
+        if (desc_hasViews(volume, fdTable_slot(volume, i)->desc)) return handleError("cannot un-mount file system - read views are still held");
+    }
+
+    //sync the process data to the file
+    if (fs_sync(volume) == ERR) return handleError("could not fully sync file system - no process changes made");
+
+    for (int i = 0; i < volume->fds->slots && volume->fds->open > 0; i++) {
+        if (fdTable_slot(volume, i)->desc != NULL) {
+            closeFile(volume, fdTable_fd(volume, i));    //close and free the file descriptors
+        }
+    }
+
+    //the commit thread uses the image's fd so must finish before it is closed
+    if (volume->durability == DURABLE_GROUP && stopCommitter(volume) == ERR) return ERR;
+
+    //finally close the underlying file (a mapping stays valid after its fd is closed)
+    stats_syscall();
+    if (close(volume->filedes) == ERR) return handleError_p("could not un-mount file system");
+
+    //if all checks passed then the volume is no longer mounted, its structs are freed by releaseVolume
+    volume->mounted = FALSE;
+    volume->filedes = -1;
+
+    return SUC;
+}
+
+/*
+ * runs unmountImage with the volume locked, it waits for every call already running to finish
+ * then frees the volume, after which its handle must not be used again
+ */
+int umount_fs(fileSystem *volume) {
+    if (volume_check(volume) == ERR) return ERR;
+
+    volume_lock(volume, TRUE);
+    int result = unmountImage(volume);
+    volume_unlock(volume);
+
+    if (result == SUC) releaseVolume(volume);
+    return result;
+}
+
+/*
+ * sets how long a DURABLE_GROUP commit of the given volume waits for other syncs to join it
+ * a longer window batches more closes into each flush at the cost of a longer wait for each of them
+ * the window is read at the start of each commit, so this applies from the next one
+ */
+int fs_setCommitWindow(fileSystem *volume, useconds_t usecs) {
+    if (volume_check(volume) == ERR) return ERR;
+    pthread_mutex_lock(&volume->commitLock);
+    volume->commitWindow = usecs;
+    pthread_mutex_unlock(&volume->commitLock);
+    return SUC;
+}
+
+//finds the first free index at or after the given one using the free-block bitmap
+int fat_findFreeIndex(fileSystem *volume, int iterateFrom) {
+    if (!volume->mounted) return handleError("cannot access FAT of non-mounted file system");
+
+    if (iterateFrom < FIRST_FAT_INDEX || iterateFrom >= volume->table->entries)
+        return handleError("fat_findFreeIndex - index out of bounds");
+
+    return freeMap_find(volume->table->free, iterateFrom);
+}
+
+/*
+ * Iterative loop to find the next free space for a file
+ * after the passed in index
+ *
+ * often used after adding a file to the previous firstFreeIndex
+ * to look for the next free index after the last is filled
+ */
+int dir_findFreeIndex(fileSystem *volume, int iterateFrom) {
+    if (!volume->mounted) return handleError("cannot access directory of non-mounted file system");
+
+    if (iterateFrom < 0 || iterateFrom > volume->dir->capacity) return handleError("dir_findFreeIndex - index out of bounds");
+
+    for (int i = iterateFrom; i < volume->dir->capacity; i++) {
+        file *current = volume->dir->files[i];
+        if (strcmp(current->name, "") == 0) return i;
+    }
+    return ERR;
+}
+
+/*
+ * takes in an index value
+ * if valid returns the value stored in the FAT at that index
+ */
+int64_t fat_findByIndex(fileSystem *volume, int index) {
+    if (!volume->mounted) return handleError("cannot access FAT of non-mounted file system");
+
+    if (index >= volume->table->entries || index < FIRST_FAT_INDEX)
+        return handleError("fat index out of bounds");
+
+    return fat_get(volume, index);
+}
+
+/*
+ * Search the directory struct for a file with a name matching the search
+ * looks the name up in the directory's hash index so the cost does not grow with the directory
+ */
+int dir_search(fileSystem *volume, char *name) {
+    if (name[0] == '\0') return ERR; //free entries are not indexed
+    return volume->dir->index->slots[nameIndex_slot(volume->dir->index, volume->dir->files, name)];  //-1 (ERR) when the name is not found
+}
+
+/*
+ * overwrites the directory entry at the given index in place
+ * entries are updated rather than replaced so a mapped directory is written straight into the image
+ * a change of name moves the entry in the name index
+ */
+void dir_setEntry(fileSystem *volume, int index, char *name, int32_t fatIndex, int32_t type, int64_t size) {
+    file *entry = volume->dir->files[index];
+    int renamed = strncmp(entry->name, name, FILE_NAME_SIZE) != 0;
+    if (renamed && entry->name[0] != '\0') nameIndex_remove(volume->dir->index, volume->dir->files, entry->name);
+    set_name(entry->name, name);
+    if (renamed && entry->name[0] != '\0') nameIndex_insert(volume->dir->index, volume->dir->files, index);
+    entry->fatIndex = fatIndex;
+    entry->type = type;
+    entry->size = size;
+    entry->tailIndex = fatIndex;    //entries are only ever set to a fresh chain (or cleared)
+    entry->tailUsed = 0;
+    markDirty(volume->dir->dirty, index);
+}
+
+/*
+ * Takes in a value and a block address, if the address is valid
+ * writes it directly into the transient struct
+ * value = "" can be used to clear
+ */
+int writeBlock(fileSystem *volume, int index, char *value) {
+    if (index < FIRST_FAT_INDEX || index >= volume->table->entries)
+        return handleError("cannot write block - index out of bounds");
+
+    else if (strncpy(volume->storage->blocks[index]->data, value, volume->storage->blockSize) == NULL)
+        return handleError("cannot write block - writing error");
+
+    markDirty(volume->storage->dirty, index);
+
+    return SUC;
+}
+
+/*
+ * checks the value read from a chain's FAT index is another index of the table
+ * (anything else means the chain is damaged)
+ */
+int fat_isLink(fileSystem *volume, uint32_t value) {
+    return value >= FIRST_FAT_INDEX && value < (uint32_t) volume->table->entries;
+}
+
+/*
+ * Frees all FAT indexes in a chain starting from the given index
+ * Also clears the data blocks that they represent
+ *
+ * the chain is walked iteratively so a file of millions of blocks cannot exhaust the stack,
+ * and at most one step per index is taken so a damaged (cyclic) chain cannot loop forever
+ */
+int clearFATChain(fileSystem *volume, int index) {
+    //index check
+    if (index < FIRST_FAT_INDEX || index >= volume->table->entries)
+        return handleError("cannot clear FAT index - index out of bounds");
+
+    for (int steps = 0; steps < volume->table->entries; steps++) {
+        uint32_t next = fat_get(volume, index); //take next block address from FAT before it is freed
+        if (next != FAT_END && !fat_isLink(volume, next)) return handleError("cannot clear FAT chain - chain is damaged");
+
+        fat_set(volume, index, FAT_FREE);
+        if (writeBlock(volume, index, "") == ERR) {
+            fat_set(volume, index, next);  //undo deletion on error
+            return ERR;
+        }
+
+        if (next == FAT_END) return SUC;
+        index = next;
+    }
+    return handleError("cannot clear FAT chain - chain does not end");
+}
+
+// chain access functions
+
+/*
+ * takes the index following the given one in its chain
+ * at the end of the chain it is extended with a free block when grow is set, otherwise it is an error
+ */
+int chain_next(fileSystem *volume, int index, int grow) {
+    uint32_t next = fat_get(volume, index);
+    if (fat_isLink(volume, next)) return next;
+    if (next != FAT_END) return handleError("cannot follow chain - chain is damaged");
+    if (!grow) return handleError("cannot follow chain - offset is past the end of the chain");
+
+    int added = fat_allocateAfter(volume, NULL, index);
+    if (added == ERR) return handleError("cannot extend chain - no file space remaining");
+    fat_set(volume, index, added);
+    fat_set(volume, added, FAT_END);
+    return added;
+}
+
+// subdirectory functions
+
+//makes room for one more block in a subdirectory's block list
+int subdir_growBlocks(subDirectory *sub) {
+    if (sub->blockCount < sub->blockCapacity) return SUC;
+    int *grown = realloc(sub->blocks, (size_t) sub->blockCapacity * 2 * sizeof(int));
+    if (grown == NULL) return handleError("subdir_growBlocks - could not grow block list");
+    sub->blocks = grown;
+    sub->blockCapacity *= 2;
+    return SUC;
+}
+
+/*
+ * makes room for at least the given number of entry slots in a subdirectory's entries
+ * the entries move so their pointers are set again, and the name index is rebuilt at its new size
+ */
+int subdir_growSlots(subDirectory *sub, int slots) {
+    if (slots <= sub->capacity) return SUC;
+    int capacity = sub->capacity;
+    while (capacity < slots) capacity *= 2;
+
+    file **files = realloc(sub->files, capacity * sizeof(file *));
+    if (files != NULL) sub->files = files;
+    file *entries = realloc(sub->entries, capacity * sizeof(file));
+    if (entries != NULL) sub->entries = entries;
+    int *freeSlots = realloc(sub->freeSlots, capacity * sizeof(int));
+    if (freeSlots != NULL) sub->freeSlots = freeSlots;
+    nameIndex *index = new_nameIndex(capacity);
+    if (files == NULL || entries == NULL || freeSlots == NULL || index == NULL) {
+        free_nameIndex(index);
+        for (int i = 0; i < sub->capacity; i++) sub->files[i] = &sub->entries[i];  //the entries may have moved
+        return handleError("subdir_growSlots - could not grow directory entries");
+    }
+
+    memset(sub->entries + sub->capacity, 0, (capacity - sub->capacity) * sizeof(file));
+    for (int i = 0; i < capacity; i++) sub->files[i] = &sub->entries[i];
+    for (int i = 0; i < sub->slots; i++) {
+        if (sub->entries[i].name[0] != '\0') nameIndex_insert(index, sub->files, i);
+    }
+    free_nameIndex(sub->index);
+    sub->index = index;
+    sub->capacity = capacity;
+    return SUC;
+}
+
+/*
+ * copies bytes between a buffer and the given offset of a subdirectory's blocks through its block list
+ * writing past the last block extends the chain and the list, it does not change the directory's size
+ * returns the FAT index of the last block copied once every byte is copied
+ */
+int subdir_access(fileSystem *volume, subDirectory *sub, off_t offset, char *buffer, size_t bytes, int writing) {
+    int position = offset / volume->storage->blockSize;
+    size_t within = offset % volume->storage->blockSize;
+    int index = ERR;
+
+    while (bytes > 0) {
+        if (position == sub->blockCount) {
+            if (!writing) return handleError("cannot read directory - offset is past the end of its chain");
+            if (subdir_growBlocks(sub) == ERR) return ERR;
+            int added = chain_next(volume, sub->blocks[position - 1], TRUE);
+            if (added == ERR) return ERR;
+            sub->blocks[sub->blockCount++] = added;
+        }
+        index = sub->blocks[position];
+
+        size_t span = volume->storage->blockSize - within;
+        if (span > bytes) span = bytes;
+
+        char *data = volume->storage->blocks[index]->data + within;
+        if (writing) {
+            memcpy(data, buffer, span);
+            markDirty(volume->storage->dirty, index);
+        } else memcpy(buffer, data, span);
+
+        buffer += span;
+        bytes -= span;
+        within = 0;
+        position++;
+    }
+    return index;
+}
+
+/*
+ * gives the in-memory entries of a subdirectory, reading them the first time it is looked in
+ * its chain is walked once into the block list and every slot is read in one pass over it,
+ * after that they are kept in step by subdir_store and freed with the directory's dentry
+ * returns NULL if the directory cannot be read
+ */
+subDirectory *subdir_open(fileSystem *volume, dentry *dir) {
+    if (dir->sub != NULL) return dir->sub;
+
+    int slots = dir->entry->size / FILE_ENTRY_SIZE;
+    subDirectory *sub = new_subDirectory(slots);
+    if (sub == NULL) {
+        handleError("subdir_open - could not allocate directory entries");
+        return NULL;
+    }
+
+    //a directory keeps its first block even while it holds nothing, at most one step is taken per index
+    uint32_t index = (uint32_t) dir->entry->fatIndex;
+    for (int steps = 0; index != FAT_END; steps++) {
+        if (!fat_isLink(volume, index) || steps == volume->table->entries) {
+            free_subDirectory(sub);
+            handleError("subdir_open - directory chain is damaged");
+            return NULL;
+        }
+        if (subdir_growBlocks(sub) == ERR) {
+            free_subDirectory(sub);
+            return NULL;
+        }
+        sub->blocks[sub->blockCount++] = (int) index;
+        index = fat_get(volume, index);
+    }
+
+    char *raw = malloc(dir->entry->size > 0 ? dir->entry->size : 1);
+    if (raw == NULL || (slots > 0 && subdir_access(volume, sub, 0, raw, (size_t) slots * FILE_ENTRY_SIZE, FALSE) == ERR)) {
+        free(raw);
+        free_subDirectory(sub);
+        handleError("subdir_open - could not read directory entries");
+        return NULL;
+    }
+
+    //slots are walked from the end so the lowest empty one ends up on top of the free stack
+    sub->slots = slots;
+    for (int i = slots - 1; i >= 0; i--) {
+        deserialize(entryLayout, FIELD_COUNT(entryLayout), raw + ((size_t) i * FILE_ENTRY_SIZE), sub->files[i]);
+        if (sub->files[i]->name[0] != '\0') {
+            sub->storing++;
+            nameIndex_insert(sub->index, sub->files, i);
+        } else sub->freeSlots[sub->freeCount++] = i;
+    }
+    free(raw);
+
+    dir->sub = sub;
+    return sub;
+}
+
+//the slot the next entry added to a subdirectory takes, the last empty one freed or a new one on the end
+int subdir_freeSlot(subDirectory *sub) {
+    return sub->freeCount > 0 ? sub->freeSlots[sub->freeCount - 1] : sub->slots;
+}
+
+void dentry_store(fileSystem *volume, dentry *node);
+
+/*
+ * writes an entry to the given slot of a subdirectory's blocks and its in-memory entries
+ * a slot past the end grows the directory, and the directory's own entry is stored with its new size and tail
+ * setting or clearing a slot's name keeps the name index, the entry count and the free slots in step
+ */
+int subdir_store(fileSystem *volume, dentry *dir, int slot, file *entry) {
+    subDirectory *sub = subdir_open(volume, dir);
+    if (sub == NULL) return ERR;
+    if (slot >= sub->slots && subdir_growSlots(sub, slot + 1) == ERR) return ERR;
+
+    char raw[FILE_ENTRY_SIZE];
+    serialize(entryLayout, FIELD_COUNT(entryLayout), entry, raw);
+    int last = subdir_access(volume, sub, (off_t) slot * FILE_ENTRY_SIZE, raw, FILE_ENTRY_SIZE, TRUE);
+    if (last == ERR) return ERR;
+
+    file *held = sub->files[slot];
+    int wasNamed = slot < sub->slots && held->name[0] != '\0';
+    int isNamed = entry->name[0] != '\0';
+    int renamed = !wasNamed || !isNamed || strncmp(held->name, entry->name, FILE_NAME_SIZE) != 0;
+
+    if (wasNamed && renamed) nameIndex_remove(sub->index, sub->files, held->name);
+    *held = *entry;
+    if (isNamed && renamed) nameIndex_insert(sub->index, sub->files, slot);
+
+    if (wasNamed && !isNamed) {
+        sub->storing--;
+        sub->freeSlots[sub->freeCount++] = slot;
+    } else if (!wasNamed && isNamed) {
+        sub->storing++;
+        //the slot taken is the top of the free stack unless it is a new one on the end
+        for (int i = sub->freeCount - 1; i >= 0 && slot < sub->slots; i--) {
+            if (sub->freeSlots[i] != slot) continue;
+            sub->freeSlots[i] = sub->freeSlots[--sub->freeCount];
+            break;
+        }
+    } else if (!isNamed && slot >= sub->slots) sub->freeSlots[sub->freeCount++] = slot;
+
+    if (slot >= sub->slots) {
+        sub->slots = slot + 1;
+        dir->entry->size = (int64_t) sub->slots * FILE_ENTRY_SIZE;
+        dir->entry->tailIndex = last;   //the new last slot ends in the last block of the chain
+        dir->entry->tailUsed = (int32_t) ((dir->entry->size - 1) % volume->storage->blockSize + 1);
+        dentry_store(volume, dir);
+    }
+    return SUC;
+}
+
+// dentry cache functions
+
+//hash of a dentry's key, the name mixed with the address of its parent
+uint32_t dcache_hash(dentry *parent, const char *name) {
+    return nameIndex_hash(name) ^ ((uint32_t) ((uintptr_t) parent >> 4) * 2654435761u);
+}
+
+//finds the cached dentry of the named entry of a directory, NULL when it is not cached
+dentry *dcache_find(fileSystem *volume, dentry *parent, const char *name) {
+    dentry *current = volume->dcache->buckets[dcache_hash(parent, name) & (volume->dcache->capacity - 1)];
+    while (current != NULL && (current->parent != parent || strncmp(current->name, name, FILE_NAME_SIZE) != 0))
+        current = current->hashNext;
+    return current;
+}
+
+//unlinks a dentry from the cache and frees it
+void dcache_remove(fileSystem *volume, dentry *node) {
+    dentry **link = &volume->dcache->buckets[dcache_hash(node->parent, node->name) & (volume->dcache->capacity - 1)];
+    while (*link != node) link = &(*link)->hashNext;
+    *link = node->hashNext;
+
+    node->parent->children--;
+    volume->dcache->count--;
+    free_dentry(volume->dentryPool, node);
+}
+
+/*
+ * drops every cached dentry that nothing depends on (no open descriptors and no cached children)
+ * keep is spared so the dentry being added survives
+ */
+void dcache_evict(fileSystem *volume, dentry *keep) {
+    for (int i = 0; i < volume->dcache->capacity; i++) {
+        dentry *current = volume->dcache->buckets[i];
+        while (current != NULL) {
+            dentry *next = current->hashNext;
+            if (current != keep && current->descriptors == 0 && current->children == 0) dcache_remove(volume, current);
+            current = next;
+        }
+    }
+}
+
+/*
+ * caches the dentry of the entry at slot of a directory, an owned entry is copied into the dentry
+ * once the cache is full the unused dentries are dropped first, never the new one or its parents
+ */
+dentry *dcache_add(fileSystem *volume, dentry *parent, const char *name, int slot, file *entry, char owned) {
+    dentry *node = new_dentry(volume->dentryPool, name, parent, slot, entry, owned);
+    if (node == NULL) {
+        handleError("dcache_add - could not create dentry");
+        return NULL;
+    }
+
+    dentry **bucket = &volume->dcache->buckets[dcache_hash(parent, name) & (volume->dcache->capacity - 1)];
+    node->hashNext = *bucket;
+    *bucket = node;
+    parent->children++;
+    volume->dcache->count++;
+
+    if (volume->dcache->count > DENTRY_CACHE_MAX) dcache_evict(volume, node);
+    return node;
+}
+
+/*
+ * makes a change to a cached entry part of its directory
+ * a root entry is the directory's own struct so it only needs marking,
+ * the entry of a subdirectory is written back to the subdirectory's blocks
+ */
+void dentry_store(fileSystem *volume, dentry *node) {
+    if (node->parent == volume->rootNode) markDirty(volume->dir->dirty, node->slot);
+    else subdir_store(volume, node->parent, node->slot, node->entry);
+}
+
+/*
+ * finds the named entry of a directory, from the cache when it has been looked up before
+ * the root directory is searched through its name index and a subdirectory through the index of its entries
+ * returns NULL if the directory has no such entry
+ */
+dentry *dir_lookup(fileSystem *volume, dentry *dir, const char *name) {
+    dentry *found = dcache_find(volume, dir, name);
+    if (found != NULL) return found;
+
+    if (dir == volume->rootNode) {
+        int slot = dir_search(volume, (char *) name);
+        if (slot == ERR) return NULL;
+        return dcache_add(volume, dir, name, slot, volume->dir->files[slot], FALSE);
+    }
+
+    subDirectory *sub = subdir_open(volume, dir);
+    if (sub == NULL || name[0] == '\0') return NULL;   //free entries are not indexed
+    int slot = sub->index->slots[nameIndex_slot(sub->index, sub->files, name)];
+    if (slot == -1) return NULL;
+    return dcache_add(volume, dir, name, slot, sub->files[slot], TRUE);
+}
+
+// path functions
+
+/*
+ * takes the next component of a path into component, skipping the separators before it
+ * returns TRUE if a component was taken, FALSE at the end of the path and ERR if it is too long for a name
+ */
+int path_next(const char **path, char *component) {
+    while (**path == PATH_SEPARATOR) (*path)++;
+    if (**path == '\0') return FALSE;
+
+    int length = 0;
+    while ((*path)[length] != '\0' && (*path)[length] != PATH_SEPARATOR) length++;
+    if (length > FILE_NAME_SIZE) return handleError("invalid path - name too long");
+
+    memcpy(component, *path, length);
+    component[length] = '\0';
+    *path += length;
+    return TRUE;
+}
+
+/*
+ * resolves every component of a path but the last, which is copied into leaf
+ * returns the dentry of the directory that should hold the leaf, or NULL if the path does not lead to one
+ */
+dentry *path_parent(fileSystem *volume, const char *path, char *leaf) {
+    char component[FILE_NAME_SIZE + 1];
+    dentry *dir = volume->rootNode;
+
+    if (path_next(&path, leaf) != TRUE) return NULL;
+    int res;
+    while ((res = path_next(&path, component)) == TRUE) {
+        dir = dir_lookup(volume, dir, leaf);    //the component taken before is a directory on the way
+        if (dir == NULL || dir->entry->type != FILE_TYPE_DIRECTORY) return NULL;
+        strcpy(leaf, component);
+    }
+    return res == ERR ? NULL : dir;
+}
+
+//resolves a path to the dentry of its entry, NULL if it does not exist
+dentry *path_resolve(fileSystem *volume, const char *path) {
+    char leaf[FILE_NAME_SIZE + 1];
+    dentry *dir = path_parent(volume, path, leaf);
+    if (dir == NULL) return NULL;
+    return dir_lookup(volume, dir, leaf);
+}
+
+/*
+ * adds a new empty entry of the given type to a directory and caches its dentry
+ * the entry gets a single block of its own, in the root directory it takes the first free slot
+ * and in a subdirectory the first free slot or a new one on the end
+ */
+dentry *dir_addEntry(fileSystem *volume, dentry *dir, const char *name, int type) {
+    if (dir == volume->rootNode && volume->dir->storing == volume->dir->capacity) {
+        handleError("cannot add entry - directory is full");
+        return NULL;
+    }
+
+    int first = volume->table->nextFreeSlot;
+    if (first == ERR) {
+        handleError("cannot add entry - no free space in FAT");
+        return NULL;
+    }
+    fat_set(volume, first, FAT_END);  //one less free index in FAT
+
+    if (dir == volume->rootNode) {
+        int insert = volume->dir->nextFreeSlot;
+        dir_setEntry(volume, insert, (char *) name, first, type, 0);
+        volume->dir->storing++;
+        volume->dir->nextFreeSlot = dir_findFreeIndex(volume, insert);
+        return dcache_add(volume, dir, name, insert, volume->dir->files[insert], FALSE);
+    }
+
+    subDirectory *sub = subdir_open(volume, dir);
+    if (sub == NULL) {
+        fat_set(volume, first, FAT_FREE);
+        return NULL;
+    }
+    int slot = subdir_freeSlot(sub);
+
+    file entry;
+    set_file(&entry, (char *) name, first, 0);
+    entry.type = type;
+    if (subdir_store(volume, dir, slot, &entry) == ERR) {
+        fat_set(volume, first, FAT_FREE);
+        handleError("cannot add entry - could not write directory");
+        return NULL;
+    }
+    return dcache_add(volume, dir, name, slot, &entry, TRUE);
+}
+
+/*
+ * removes an entry from its directory, freeing its chain and its dentry
+ * the slot it leaves is reused by the next entry added to the directory
+ */
+int dir_removeEntry(fileSystem *volume, dentry *node) {
+    if (clearFATChain(volume, node->entry->fatIndex) == ERR) return ERR;
+
+    if (node->parent == volume->rootNode) {
+        dir_setEntry(volume, node->slot, "", -1, FILE_TYPE_REGULAR, -1);
+        volume->dir->storing--;
+        if (volume->dir->nextFreeSlot == ERR || node->slot < volume->dir->nextFreeSlot) volume->dir->nextFreeSlot = node->slot;
+    } else {
+        file empty;
+        set_file(&empty, "", -1, -1);
+        if (subdir_store(volume, node->parent, node->slot, &empty) == ERR) return ERR;
+    }
+
+    dcache_remove(volume, node);
+    return SUC;
+}
+
+/*
+ * adds the newly created descriptor to the descriptor table returning the fd naming it
+ * if the table is full returns error
+ *
+ * if the file is already open for writing (checked in the open-file table) then
+ * any request to open it again for writing is disallowed
+ * a descriptor that is not added is freed here so callers can return the result as it is
+ */
+int addDescriptor(fileSystem *volume, descriptor *toAdd) {
+    if (toAdd == NULL) return handleError("cannot open file - could not create file descriptor");
+    int forWrite = (toAdd->mode == O_WRONLY);
+    dentry *state = toAdd->node;
+
+    // prevents two instances of a file being opened for writing
+    if (forWrite && state->writing) {
+        free_descriptor(volume->descriptorPool, toAdd);
+        return handleError("cannot open file - only one instance of a file can be open for writing at once");
+    }
+
+    int fd = fdTable_add(volume, toAdd);
+    if (fd == ERR) {
+        free_descriptor(volume->descriptorPool, toAdd);
+        return handleError("cannot open file - max open file descriptors reached");
+    }
+
+    state->descriptors++;
+    if (forWrite) state->writing = TRUE;
+    return fd;  //if it was added return the fd
+}
+
+/*
+ * function for overwriting a file
+ * Takes in the cached entry of the file to overwrite
+ * it checks if the file is open and if so will throw an error as open files cannot be
+ * overwritten (with this method due to the affect it would have on file descriptors)
+ * If the file exits but is not open then it will be cleared and replaced with an empty file
+ * of the same name
+ */
+int overwriteFile(fileSystem *volume, dentry *node) {
+    if (node->descriptors > 0)
+        return handleError(
+                "cannot create file - file exists and cannot be overwritten: has at least one open file descriptor ");
+
+
+    file *toChange = node->entry;
+    int fatIndex = toChange->fatIndex;
+    clearFATChain(volume, fatIndex);
+
+    //the cleared chain freed the first block too, so take it back as the new end of chain
+    fat_set(volume, fatIndex, FAT_END);
+    toChange->size = 0;
+    toChange->tailIndex = fatIndex;
+    toChange->tailUsed = 0;
+    dentry_store(volume, node);
+
+    //create file descriptor for opened file, like a new file it starts at file pointer 0
+    descriptor *desc = new_descriptor(volume->descriptorPool, toChange, node, O_WRONLY, 0);
 
     //adds it to the global array and returns either an error or the int used to locate it
-    int fd = addDescriptor(desc);
+    int fd = addDescriptor(volume, desc);
     return fd;
 }
 
 /*
- * Function for creating a new file using the given name
+ * Function for creating a new file using the given name (or path)
  * First checks the name is valid and that the system is mounted
- * Then checks that the directory has space for a new file to be created
+ * Then resolves the directory that will hold the file
  *
  * If these checks pass then it will check if a file with the name already exists
- * if one does it will attempt to overwrite it (see overwriteFile(char *name)
- * otherwise it will check that there is space in the FAT (i.e. in memory)
- * to store the new file throwing an error if there is not
- * it will then make this free entry the end of a chain and
- * find a new lowestFreeIndex
- *
- * We then create a new file and check that the value of
- * the directory's nextFreeSlot is valid before assigning the file there
- * and finding the next lowest free spot
+ * if one does it will attempt to overwrite it (see overwriteFile(volume, dentry *node)
+ * otherwise it will add a new entry to the directory (see dir_addEntry) which takes a
+ * free block in the FAT as the end of the file's chain
  *
  * The final step is to create and return a file descriptor for the newly created file
- * in essence create opens the file for reading after making it
+ * in essence create opens the file for writing after making it
  *
  * The function returns either the file descriptor of the file or -1 if it or the file descriptor
  * cannot be created. If the file descriptor cannot be created the file still exist
  * but must have open called on it in order to be used.
  */
-int fs_create(char *name) {
-    if (!mounted) return handleError("cannot create file - file system is unmounted");
+int createFile(fileSystem *volume, char *name) {
+    if (!volume->mounted) return handleError("cannot create file - file system is unmounted");
     if (name == NULL || strcmp(name, "") == 0) {
         return handleError("cannot create file - invalid filename");
     }
 
-    if (!mounted) return handleError("cannot create file - system not mounted");
-    if (rootDir->storing == MAX_ENTRIES) return handleError("cannot create file - directory is full");
+    char leaf[FILE_NAME_SIZE + 1];
+    dentry *dir = path_parent(volume, name, leaf);
+    if (dir == NULL) return handleError("cannot create file - invalid path");
+
+    dentry *node = dir_lookup(volume, dir, leaf);
+    if (node != NULL) {
+        if (node->entry->type == FILE_TYPE_DIRECTORY) return handleError("cannot create file - name is a directory");
+        return overwriteFile(volume, node);
+    }
+
+    node = dir_addEntry(volume, dir, leaf, FILE_TYPE_REGULAR);
+    if (node == NULL) return handleError("cannot create file - could not add directory entry");
+
+    //new files are created and opened for writing, starting at file pointer 0
+    descriptor *desc = new_descriptor(volume->descriptorPool, node->entry, node, O_WRONLY, 0);
+    return addDescriptor(volume, desc);
+}
+
+//runs createFile under the metadata lock
+int fs_create(fileSystem *volume, char *name) {
+    uint64_t start = stats_start();
+    if (volume_check(volume) == ERR) return stats_done(STATS_CREATE, start, ERR);
+    meta_lock(volume);
+    int fd = createFile(volume, name);
+    meta_unlock(volume);
+    return stats_done(STATS_CREATE, start, fd);
+}
 
+/*
+ * Function that deletes a file takes in the name (or path) of the file to delete
+ * checks the file system is mounted and that the file exists
+ * then checks that the file is not open
+ *
+ * removing the entry frees all of the FAT indexes allocated to this file and the related
+ * data blocks, then clears its directory entry setting it's values to those that
+ * represent a free file struct freeing that slot for another file (see dir_removeEntry)
+ *
+ * then writes a sync to update the file, which the caller flushes once it drops its locks,
+ * and returns either 0 or -1 if a check failed
+ */
+int deleteFile(fileSystem *volume, char *name, pendingSync *pending) {
+    if (!volume->mounted) return handleError("cannot delete file - file system is unmounted");
+    dentry *node = path_resolve(volume, name);
+    if (node == NULL) return handleError("cannot delete file - file not found");
+    if (node->entry->type == FILE_TYPE_DIRECTORY) return handleError("cannot delete file - file is a directory");
+    if (node->descriptors > 0) return handleError("cannot delete file - file is currently open");
 
-    int fd;
-    if ((dir_search(name)) == ERR) {
+    if (dir_removeEntry(volume, node) == ERR) return ERR;
 
-        int16_t index;
-        if ((index = table->nextFreeSlot) == ERR) return handleError("cannot create file - no free space in FAT");
-        table->table[index] = '\0';
-        table->storing++; //one less free index in FAT
-        table->nextFreeSlot = fat_findFreeIndex(
-                index); //as we added to the first free index, the next free index must be larger
+    return sync_write(volume, pending);
+}
 
-        file *new = new_file(name, index, 0);
+//runs deleteFile under the metadata lock, its sync is flushed after the lock is dropped
+int fs_delete(fileSystem *volume, char *name) {
+    uint64_t start = stats_start();
+    if (volume_check(volume) == ERR) return stats_done(STATS_DELETE, start, ERR);
+    pendingSync pending = {FALSE, 0};
+    meta_lock(volume);
+    int result = deleteFile(volume, name, &pending);
+    return stats_done(STATS_DELETE, start, meta_unlockSync(volume, result, &pending));
+}
 
-        int insert;
-        if ((insert = rootDir->nextFreeSlot) == ERR)
-            return handleError("cannot create file - cannot find first free index in directory");
+/*
+ * creates an empty subdirectory at the given path
+ * its entries are kept in its own blocks so it grows a block at a time as files are added
+ * the sync it writes is flushed by the caller once it drops its locks
+ */
+int makeDirectory(fileSystem *volume, char *path, pendingSync *pending) {
+    if (!volume->mounted) return handleError("cannot make directory - file system is unmounted");
+    if (path == NULL) return handleError("cannot make directory - invalid path");
 
-        else {
-            rootDir->files[insert] = new;
-            rootDir->storing++;
-            rootDir->nextFreeSlot = dir_findFreeIndex(insert);
+    char leaf[FILE_NAME_SIZE + 1];
+    dentry *dir = path_parent(volume, path, leaf);
+    if (dir == NULL) return handleError("cannot make directory - invalid path");
+    if (dir_lookup(volume, dir, leaf) != NULL) return handleError("cannot make directory - name already exists");
 
-            //new files are created and opened for writing, starting at file pointer 0
-            descriptor *desc = new_descriptor(new, O_WRONLY, 0);
-            fd = addDescriptor(desc);
-        }
+    if (dir_addEntry(volume, dir, leaf, FILE_TYPE_DIRECTORY) == NULL) return ERR;
 
-    } else fd = overwriteFile(name);
+    return sync_write(volume, pending);
+}
 
-    return fd;
+//runs makeDirectory under the metadata lock, its sync is flushed after the lock is dropped
+int fs_mkdir(fileSystem *volume, char *path) {
+    uint64_t start = stats_start();
+    if (volume_check(volume) == ERR) return stats_done(STATS_MKDIR, start, ERR);
+    pendingSync pending = {FALSE, 0};
+    meta_lock(volume);
+    int result = makeDirectory(volume, path, &pending);
+    return stats_done(STATS_MKDIR, start, meta_unlockSync(volume, result, &pending));
 }
 
 /*
- * Function that deletes a file takes in the name of the file to delete
- * checks the file system is mounted and that the file exists in the directory
- * then checks that the file is not open
- *
- * takes the file from the directory struct and gets its FAT index
- * it uses this index for the call to recursive clear that will free all of the FAT
- * indexes allocated to this file and the related data blocks. This may update the FAT's
- * nextFreeSlot value if an index lower than it's current value is freed.
- *
- * If this is completely successful it will then clear the directory index for itself
- * setting it's values to those that represent a free file struct
- * freeing that slot for another file
- * this may update the directory's nextFreeSlot value if an index lower than its current
- * value is freed up
- *
- * then calls sync to update the file and returns either 0 or -1 if a check failed
+ * deletes the subdirectory at the given path, which must not hold any entries
+ * the sync it writes is flushed by the caller once it drops its locks
  */
-int fs_delete(char *name) {
-    if (!mounted) return handleError("cannot delete file - file system is unmounted");
-    int dirIndex;
-    if ((dirIndex = dir_search(name)) == ERR) return handleError("cannot delete file - file not found");
-    if (fileIsOpen(name)) return handleError("cannot delete file - file is currently open");
+int removeDirectory(fileSystem *volume, char *path, pendingSync *pending) {
+    if (!volume->mounted) return handleError("cannot remove directory - file system is unmounted");
+    if (path == NULL) return handleError("cannot remove directory - invalid path");
 
-    file *toRemove = rootDir->files[dirIndex];
-    int fatIndex = toRemove->fatIndex;
-    if (recursiveFATClear(fatIndex) == ERR) return ERR;
+    dentry *node = path_resolve(volume, path);
+    if (node == NULL) return handleError("cannot remove directory - directory not found");
+    if (node->entry->type != FILE_TYPE_DIRECTORY) return handleError("cannot remove directory - not a directory");
 
-    rootDir->files[dirIndex] = new_file("", -1, -1);
-    if (dirIndex < rootDir->nextFreeSlot) rootDir->nextFreeSlot = dirIndex;
+    //a cached child is always a live entry, otherwise the directory's entries keep count
+    subDirectory *sub = node->children == 0 ? subdir_open(volume, node) : NULL;
+    if (node->children == 0 && sub == NULL) return ERR;
+    if (node->children > 0 || sub->storing > 0) return handleError("cannot remove directory - directory is not empty");
 
-    if (fs_sync() == ERR) return ERR;
+    if (dir_removeEntry(volume, node) == ERR) return ERR;
 
-    return SUC;
+    return sync_write(volume, pending);
+}
+
+//runs removeDirectory under the metadata lock, its sync is flushed after the lock is dropped
+int fs_rmdir(fileSystem *volume, char *path) {
+    uint64_t start = stats_start();
+    if (volume_check(volume) == ERR) return stats_done(STATS_RMDIR, start, ERR);
+    pendingSync pending = {FALSE, 0};
+    meta_lock(volume);
+    int result = removeDirectory(volume, path, &pending);
+    return stats_done(STATS_RMDIR, start, meta_unlockSync(volume, result, &pending));
+}
+
+/*
+ * reads the size of a file for a metadata call, which does not wait for the file's writer
+ * the writer stores each new size with a relaxed atomic store so it is read whole
+ */
+off_t file_size(file *entry) {
+    return (off_t) __atomic_load_n(&entry->size, __ATOMIC_RELAXED);
 }
 
 /*
- * checks the directory contains the file name entered are looking for
+ * resolves the file name (or path) we are looking for
  * then creates a descriptor for the file and adds it to the table
  * returns the file descriptor of the opened file or -1 if it does not exist
  */
-int fs_open(char *name, int mode) {
-    if (!mounted) return handleError("cannot open file - file system not mounted");
+int openFile(fileSystem *volume, char *name, int mode) {
+    if (!volume->mounted) return handleError("cannot open file - file system not mounted");
 
     //for now only read and write modes are permitted
     if (mode != O_RDONLY && mode != O_WRONLY) return handleError("could not open file - provided invalid mode");
 
-    //find the file in the dir
-    int fileIndex = dir_search(name);
-    if (fileIndex == ERR) return handleError("cannot open file - file not found");
-
-    //create a new description and add it to the
-    file *file = rootDir->files[fileIndex];
-    int block = file->fatIndex; //each FAT index represents a block
+    //find the file
+    dentry *node = path_resolve(volume, name);
+    if (node == NULL) return handleError("cannot open file - file not found");
+    if (node->entry->type == FILE_TYPE_DIRECTORY) return handleError("cannot open file - file is a directory");
 
-    //just opened files start with their file pointer at the start of the file
-    descriptor *dec = new_descriptor(file, mode, 0);
+    //readers start at the start of the file, writers at its end so a reopened file is appended to
+    descriptor *dec = new_descriptor(volume->descriptorPool, node->entry, node, mode, mode == O_WRONLY ? file_size(node->entry) : 0);
 
-    int fd = addDescriptor(dec);
+    int fd = addDescriptor(volume, dec);
     return fd;
 
 }
 
+//runs openFile under the metadata lock
+int fs_open(fileSystem *volume, char *name, int mode) {
+    uint64_t start = stats_start();
+    if (volume_check(volume) == ERR) return stats_done(STATS_OPEN, start, ERR);
+    meta_lock(volume);
+    int fd = openFile(volume, name, mode);
+    meta_unlock(volume);
+    return stats_done(STATS_OPEN, start, fd);
+}
+
 /*
- * while there is no space in the current block move to the next block in it's chain
- * if there is no next block try and assign a new block
- * either way find the space left in the block and assign in to the variable
+ * resolves the file name (or path) and returns the size in bytes recorded in its entry
+ * a directory's size is the bytes of entry slots it has used
+ * returns -1 if there is no such file
  */
-size_t nextNonFullBlock(int *currentFatIndex, block **store) {
-    size_t spaceLeft = 0;
-    char currentFatValue;
+off_t fileSize(fileSystem *volume, char *name) {
+    if (!volume->mounted) return handleError("cannot get file size - file system not mounted");
+    if (name == NULL) return handleError("cannot get file size - invalid filename");
 
-    while (spaceLeft == 0) {
-        currentFatValue = table->table[*currentFatIndex]; //take the value from the FAT at current index
+    dentry *node = path_resolve(volume, name);
+    if (node == NULL) return handleError("cannot get file size - file not found");
+    return file_size(node->entry);
+}
 
-        if (currentFatValue == '\0') {   //if end of chain
-            if (table->nextFreeSlot == -1) return handleError("could not finish writing - no file space remaining");
-            else {
+//runs fileSize under the metadata lock, which keeps the file from being removed while its size is read
+off_t fs_filesize(fileSystem *volume, char *name) {
+    if (volume_check(volume) == ERR) return ERR;
+    meta_lock(volume);
+    off_t size = fileSize(volume, name);
+    meta_unlock(volume);
+    return size;
+}
 
-                table->table[*currentFatIndex] = table->nextFreeSlot;    //assign old end of chain to point to new
-                *currentFatIndex = table->nextFreeSlot;  //assign the current index to the newest FAT entry
-                table->table[*currentFatIndex] = '\0';   //make it the end of the chain
-                *store = storage->blocks[*currentFatIndex];   //move to this block
-                table->nextFreeSlot = fat_findFreeIndex(*currentFatIndex);   //find the next free index in FAT
+//marks the blocks a write batch has changed dirty, for a caller holding the metadata lock (the dirty set is shared with sync_write)
+void batch_markDirty(fileSystem *volume, writeBatch *batch) {
+    for (int i = 0; i < batch->dirtyCount; i++) markDirty(volume->storage->dirty, batch->dirty[i]);
+    batch->dirtyCount = 0;
+}
 
-            }
-        } else *store = storage->blocks[*currentFatIndex];
+//notes a block a write has changed, marking the batch dirty first if it is full
+void batch_addDirty(fileSystem *volume, writeBatch *batch, int index) {
+    if (batch->dirtyCount > 0 && batch->dirty[batch->dirtyCount - 1] == index) return;
+    if (batch->dirtyCount == WRITE_BATCH_BLOCKS) {
+        pthread_mutex_lock(&volume->metaLock);
+        batch_markDirty(volume, batch);
+        pthread_mutex_unlock(&volume->metaLock);
+    }
+    batch->dirty[batch->dirtyCount++] = index;
+}
+
+/*
+ * links up to wanted blocks (at most WRITE_BATCH_BLOCKS) after a file's tail for a write to fill, once its tail block is full
+ * the blocks come from the writing descriptor's extent and are listed in the batch, the write moves the tail on to each in turn
+ * the FAT is shared by every file so this is done under the metadata lock, which also marks the batch's changed blocks dirty
+ * nothing else sees the blocks before they are filled as the writer holds the file exclusively and the data lock keeps syncs out
+ * returns the number of blocks linked or ERR if there is no file space remaining
+ */
+int file_extendTail(fileSystem *volume, descriptor *desc, writeBatch *batch, int wanted) {
+    if (wanted > WRITE_BATCH_BLOCKS) wanted = WRITE_BATCH_BLOCKS;
+    int last = desc->represents->tailIndex;
+    batch->linkedCount = 0;
+    batch->linkedNext = 0;
+
+    pthread_mutex_lock(&volume->metaLock);
+    batch_markDirty(volume, batch);
+    while (batch->linkedCount < wanted) {
+        int next = fat_allocateAfter(volume, desc, last);
+        if (next == ERR) break;
+        fat_set(volume, last, next);    //assign old end of chain to point to new
+        fat_set(volume, next, FAT_END);   //make it the end of the chain
+        batch->linked[batch->linkedCount++] = next;
+        last = next;
+    }
+    pthread_mutex_unlock(&volume->metaLock);
+
+    if (batch->linkedCount == 0) return handleError("could not finish writing - no file space remaining");
+    return batch->linkedCount;
+}
+
+/*
+ * stores the entry of a file a write changed and marks the blocks the write changed dirty
+ * its directory and the dirty set are shared so both are done with one hold of the metadata lock
+ * a write with no batch (an import marks its own blocks) only stores the entry
+ */
+void file_store(fileSystem *volume, dentry *node, writeBatch *batch) {
+    pthread_mutex_lock(&volume->metaLock);
+    if (batch != NULL) batch_markDirty(volume, batch);
+    dentry_store(volume, node);
+    pthread_mutex_unlock(&volume->metaLock);
+}
+
+int desc_blockAt(fileSystem *volume, descriptor *desc, int blockNumber);
+
+/*
+ * copies the bytes of a descriptor's file from offset into buffer, a whole block span at a time
+ * finding each block through the descriptor's block map, stopping at the end of the file
+ * returns the number of bytes copied
+ */
+size_t desc_readAt(fileSystem *volume, descriptor *desc, char *buffer, size_t bytes, off_t offset) {
+    file *readFrom = desc->represents;
+    int blockSize = volume->storage->blockSize;
+
+    //never read past the end of the file
+    if (offset >= readFrom->size) return 0;
+    if ((off_t) bytes > readFrom->size - offset) bytes = readFrom->size - offset;
+
+    size_t readTotal = 0;   //the total number of bytes read this call
+    while (readTotal != bytes) {
+        int index = desc_blockAt(volume, desc, (int) (offset / blockSize));
+        if (index == ERR) break;
+
+        //copy as much of this block as is wanted
+        size_t within = offset % blockSize;
+        size_t span = blockSize - within;
+        if (span > bytes - readTotal) span = bytes - readTotal;
+        memcpy(buffer + readTotal, volume->storage->blocks[index]->data + within, span);
+
+        readTotal += span;
+        offset += span;
+    }
+    return readTotal;
+}
 
-        //take the new store and update current size
-        block *temp = *store;
-        size_t dataSize = strlen(temp->data);
-        spaceLeft = BLOCK_SIZE - dataSize;
+/*
+ * copies bytes from buffer into a descriptor's file at offset, the largest span that fits in each block at a time
+ * bytes before the end of the file overwrite the blocks already there (found through the descriptor's block map)
+ * the rest are appended at the file's tail, which its entry records along with how
+ *      much of the tail block is used, so the chain is never walked to find the end
+ * once the tail block is full the blocks for the rest of the bytes are linked on from the descriptor's extent a batch at a time
+ * every byte counts towards the size, whatever its value
+ * the blocks changed are listed in batch, the caller marks them dirty as it stores the entry once it has finished writing
+ * returns the number of bytes copied, fewer than asked for if there is no free block
+ */
+size_t desc_writeAt(fileSystem *volume, descriptor *desc, writeBatch *batch, const char *buffer, size_t bytes, off_t offset) {
+    size_t writenTotal = 0; //the total number of bytes writen this call
+    file *writeTo = desc->represents;
+    int blockSize = volume->storage->blockSize;
+
+    //overwrite whatever lies between the offset and the end of the file
+    while (writenTotal != bytes && offset < writeTo->size) {
+        int index = desc_blockAt(volume, desc, (int) (offset / blockSize));
+        if (index == ERR) break;
+
+        size_t within = offset % blockSize;
+        size_t span = blockSize - within;
+        if (span > bytes - writenTotal) span = bytes - writenTotal;
+        if ((off_t) span > writeTo->size - offset) span = writeTo->size - offset;   //the rest is appended below
+        memcpy(volume->storage->blocks[index]->data + within, buffer + writenTotal, span);
+        batch_addDirty(volume, batch, index);
+
+        writenTotal += span;
+        offset += span;
+    }
+
+    //then append at the tail, filling what is left of each block before linking the next
+    while (writenTotal != bytes && offset == writeTo->size) {
+        if (writeTo->tailUsed == blockSize) {
+            //every block linked gets at least one byte, so the chain never runs past the tail once the call is done
+            if (batch->linkedNext == batch->linkedCount &&
+                    file_extendTail(volume, desc, batch, (int) ((bytes - writenTotal + blockSize - 1) / blockSize)) == ERR) break;  //stop writing if there is no space
+            writeTo->tailIndex = batch->linked[batch->linkedNext++];
+            writeTo->tailUsed = 0;
+        }
+
+        size_t span = blockSize - writeTo->tailUsed;
+        if (span > bytes - writenTotal) span = bytes - writenTotal;
+        memcpy(volume->storage->blocks[writeTo->tailIndex]->data + writeTo->tailUsed, buffer + writenTotal, span);
+        batch_addDirty(volume, batch, writeTo->tailIndex);
+
+        writeTo->tailUsed += span;
+        __atomic_store_n(&writeTo->size, writeTo->size + span, __ATOMIC_RELAXED);   //read by metadata calls (see file_size)
+        writenTotal += span;
+        offset += span;
+    }
+    return writenTotal;
+}
+
+/*
+ * waits until no read view of the file is held, so a writer never changes bytes a view points at
+ * the file's lock is held exclusively by then so no new view can be taken meanwhile
+ */
+void file_waitUnpinned(fileSystem *volume, dentry *node) {
+    pthread_mutex_lock(&volume->pinLock);
+    while (node->pins > 0) pthread_cond_wait(&volume->unpinned, &volume->pinLock);
+    pthread_mutex_unlock(&volume->pinLock);
+}
+
+/*
+ * checks the volume, finds the descriptor of fd if it is open for reading (O_RDONLY) or writing (O_WRONLY) and takes the
+ * locks a data operation runs under: the volume shared, the descriptor's file pointer when the call moves it,
+ * then the file's lock, shared for reading so readers of a file run side by side and exclusive for writing,
+ * writers then take the data lock shared so their blocks are not written out by a sync part way through a copy
+ * returns NULL holding no locks and reports why if it is not open in that mode
+ */
+descriptor *desc_acquire(fileSystem *volume, int fd, int mode, int moving) {
+    int reading = mode == O_RDONLY;
+    if (volume_check(volume) == ERR) return NULL;
+    volume_lock(volume, FALSE);
+
+    descriptor *desc;
+    if ((desc = desc_take(volume, fd)) == NULL) {
+        volume_unlock(volume);
+        handleError(reading ? "cannot read file - file is not open" : "cannot write file - file is not open");
+        return NULL;
+    }
+    if (desc->mode != mode) {
+        desc_drop(volume, desc);
+        volume_unlock(volume);
+        handleError(reading ? "cannot read file - file not open for reading" : "cannot write file - file not open for writing");
+        return NULL;
+    }
+
+    if (moving) pthread_mutex_lock(&desc->posLock);
+    if (reading) pthread_rwlock_rdlock(&desc->node->lock);
+    else {
+        pthread_rwlock_wrlock(&desc->node->lock);
+        file_waitUnpinned(volume, desc->node);
+        pthread_rwlock_rdlock(&volume->dataLock);
     }
-    return spaceLeft;
+    return desc;
+}
+
+//releases the locks taken by desc_acquire
+void desc_release(fileSystem *volume, descriptor *desc, int moving) {
+    if (desc->mode == O_WRONLY) pthread_rwlock_unlock(&volume->dataLock);
+    pthread_rwlock_unlock(&desc->node->lock);
+    if (moving) pthread_mutex_unlock(&desc->posLock);
+    desc_drop(volume, desc);
+    volume_unlock(volume);
+}
+
+/*
+ * Function for reading data from a file
+ * takes in:
+ *  it's file descriptor - used to find the file* object and its file pointer
+ *  a buffer to copy the data into
+ *  a size_t representing the most bytes to read into that buffer
+ *
+ *  It will first check the file is open for reading
+ *  then it copies from the file pointer up to the end of the file (see desc_readAt)
+ *  it then moves the file pointer past the bytes read
+ *
+ *  returns the number of bytes read (0 at the end of the file), or ERR if:
+ *      file is not open
+ *      file is not open for reading
+ */
+ssize_t fs_read(fileSystem *volume, int fd, void *buffer, size_t nbytes) {
+    uint64_t start = stats_start();
+    descriptor *desc = desc_acquire(volume, fd, O_RDONLY, TRUE);
+    if (desc == NULL) return stats_done(STATS_READ, start, ERR);
+
+    size_t readTotal = desc_readAt(volume, desc, (char *) buffer, nbytes, desc->fp);
+    desc->fp += readTotal;
+
+    desc_release(volume, desc, TRUE);
+    return stats_done(STATS_READ, start, readTotal);
 }
 
 /*
@@ -797,115 +2671,790 @@ size_t nextNonFullBlock(int *currentFatIndex, block **store) {
  *  a size_t representing the number of bytes to read from that buffer
  *
  *  It will first check the file exists and is opened for writing
- *  then it will move to the file pointer and write UP TO
- *      the size of a block (keep track of how many bytes written)
- *  it will then update the file pointer
- *  if the block is not enough to store the buffer data
- *  find a new free block to write in
+ *  then it will write from the file pointer (see desc_writeAt)
  *  if there is no free block inform user and exit with the number of bytes written
+ *  it then moves the file pointer past the bytes written
  *
  *  returns ERR instead of bytes written if:
  *      file does not exist
  *      file is not open
  *      file is not open for writing
  */
-int fs_write(int fd, void *buffer, size_t nbytes) {
-    //cast buffer to char array
-    char *writeData = (char *) buffer;
+ssize_t fs_write(fileSystem *volume, int fd, void *buffer, size_t nbytes) {
+    uint64_t start = stats_start();
+    descriptor *desc = desc_acquire(volume, fd, O_WRONLY, TRUE);
+    if (desc == NULL) return stats_done(STATS_WRITE, start, ERR);
+
+    writeBatch batch = {0};
+    size_t writenTotal = desc_writeAt(volume, desc, &batch, (char *) buffer, nbytes, desc->fp);
+    desc->fp += writenTotal;
+
+    //the entry's new size and tail have to reach its directory
+    if (writenTotal > 0) file_store(volume, desc->node, &batch);
+    desc_release(volume, desc, TRUE);
+    return stats_done(STATS_WRITE, start, writenTotal);
+}
 
-    //get and check descriptor
-    descriptor *desc;
-    if ((desc = fds[fd]) == NULL) return handleError("cannot write file - file is not open");
-    if (desc->mode != O_WRONLY) return handleError("cannot write file - file not open for writing");
+/*
+ * Function for reading a range of a file without copying it
+ * fills in view with the runs of blocks holding nbyte bytes from offset (fewer at the end of the file),
+ * neighbouring blocks that are also neighbours in memory make up one run
+ * the blocks are pinned until fs_release_view: writers to the file wait for it and the descriptor
+ * cannot be closed, so the view must be released before the volume is un-mounted
+ * the file pointer is neither used nor moved
+ * returns the number of bytes in the view, or ERR if:
+ *      no view is given or the offset is negative
+ *      file is not open
+ *      file is not open for reading
+ */
+ssize_t viewFile(fileSystem *volume, int fd, readView *view, size_t nbytes, off_t offset) {
+    if (view == NULL) return handleError("cannot read view - no view given");
+    if (offset < 0) return handleError("cannot read view - invalid offset: negative value");
+    descriptor *desc = desc_acquire(volume, fd, O_RDONLY, FALSE);
+    if (desc == NULL) return ERR;
+
+    file *readFrom = desc->represents;
+    int blockSize = volume->storage->blockSize;
+    if (offset >= readFrom->size) nbytes = 0;
+    else if ((off_t) nbytes > readFrom->size - offset) nbytes = readFrom->size - offset;
+
+    //a run per block is the most the range can need
+    size_t runs = nbytes == 0 ? 1 : (offset % blockSize + nbytes + blockSize - 1) / blockSize;
+    view->iov = malloc(runs * sizeof(struct iovec));
+    view->iovcnt = 0;
+    view->bytes = 0;
+    view->fildes = fd;
+    if (view->iov == NULL) {
+        desc_release(volume, desc, FALSE);
+        return handleError("cannot read view - could not allocate runs");
+    }
 
-    //now need to write from the buffer to the first dataBlock
-    int writenTotal = 0; //the total number of bytes writen this call
+    while (view->bytes != nbytes) {
+        int index = desc_blockAt(volume, desc, (int) (offset / blockSize));
+        if (index == ERR) break;
 
-    //gets the file from the descriptor and the start of it's fat chain
-    file *writeTo = desc->represents;
-    int currentIndex = writeTo->fatIndex;
+        size_t within = offset % blockSize;
+        size_t span = blockSize - within;
+        if (span > nbytes - view->bytes) span = nbytes - view->bytes;
+        char *data = volume->storage->blocks[index]->data + within;
+
+        struct iovec *last = view->iovcnt > 0 ? &view->iov[view->iovcnt - 1] : NULL;
+        if (last != NULL && (char *) last->iov_base + last->iov_len == data) last->iov_len += span;
+        else view->iov[view->iovcnt++] = (struct iovec) {data, span};
+
+        view->bytes += span;
+        offset += span;
+    }
+
+    //pinned before the file's lock is dropped so no writer gets in between
+    pthread_mutex_lock(&volume->pinLock);
+    desc->node->pins++;
+    desc->views++;
+    pthread_mutex_unlock(&volume->pinLock);
+
+    desc_release(volume, desc, FALSE);
+    return view->bytes;
+}
+
+//runs viewFile, timing the call for fs_stats
+ssize_t fs_read_view(fileSystem *volume, int fd, readView *view, size_t nbytes, off_t offset) {
+    uint64_t start = stats_start();
+    return stats_done(STATS_VIEW, start, viewFile(volume, fd, view, nbytes, offset));
+}
+
+/*
+ * Function for releasing a view taken with fs_read_view, its runs must not be used afterwards
+ * once a file's last view is released any writers waiting for it carry on
+ * returns 0, or ERR if the view is not held
+ */
+int fs_release_view(fileSystem *volume, readView *view) {
+    if (view == NULL || view->iov == NULL) return handleError("cannot release view - view is not held");
+    if (volume_check(volume) == ERR) return ERR;
+    volume_lock(volume, FALSE);
+
+    //a descriptor with a view cannot be closed, so the view's descriptor is still in the table
+    descriptor *desc = desc_take(volume, view->fildes);
+    pthread_mutex_lock(&volume->pinLock);
+    int held = desc != NULL && desc->views > 0;
+    if (held) {
+        desc->views--;
+        if (--desc->node->pins == 0) pthread_cond_broadcast(&volume->unpinned);
+    }
+    pthread_mutex_unlock(&volume->pinLock);
+    if (desc != NULL) desc_drop(volume, desc);
+    volume_unlock(volume);
+    if (!held) return handleError("cannot release view - view is not held");
+
+    free(view->iov);
+    view->iov = NULL;
+    view->iovcnt = 0;
+    view->bytes = 0;
+    return SUC;
+}
+
+// image building functions
+
+/*
+ * lists every regular file and directory under a host directory in the build, each directory before what it holds
+ * other kinds of file are left out, as is anything whose name is too long for an entry
+ * returns the number of entries listed directly in the directory, or ERR if it cannot be read
+ */
+int build_scan(imageBuild *build, const char *hostDir, int parent) {
+    stats_syscall();
+    DIR *dir = opendir(hostDir);
+    if (dir == NULL) return handleError("make_fs_from - could not read source directory");
+
+    int entries = 0;
+    struct dirent *found;
+    while ((found = readdir(dir)) != NULL) {
+        if (strcmp(found->d_name, ".") == 0 || strcmp(found->d_name, "..") == 0) continue;
+
+        char path[PATH_MAX];
+        struct stat host;
+        if (snprintf(path, PATH_MAX, "%s/%s", hostDir, found->d_name) >= PATH_MAX) continue;
+        stats_syscall();
+        if (lstat(path, &host) == ERR) continue;
+        if (!S_ISREG(host.st_mode) && !S_ISDIR(host.st_mode)) continue;
+        if (strlen(found->d_name) > FILE_NAME_SIZE) {
+            fprintf(stderr, "make_fs_from - name too long for an entry, left out: %s\n", path);
+            continue;
+        }
 
-    //gets the data block using the FAT index
-    block *store = storage->blocks[writeTo->fatIndex];
+        if (build->count == build->capacity) {
+            int capacity = build->capacity == 0 ? BUILD_LIST_MIN : build->capacity * 2;
+            buildEntry *grown = realloc(build->entries, capacity * sizeof(buildEntry));
+            if (grown == NULL) {
+                stats_syscall();
+                closedir(dir);
+                return handleError("make_fs_from - could not list source entries");
+            }
+            build->entries = grown;
+            build->capacity = capacity;
+        }
+        int index = build->count++;
+        buildEntry *entry = &build->entries[index];
+        memset(entry, 0, sizeof(buildEntry));
+        set_name(entry->name, found->d_name);   //the length was checked above, the memset leaves the terminator
+        entry->hostPath = strdup(path);
+        entry->type = S_ISDIR(host.st_mode) ? FILE_TYPE_DIRECTORY : FILE_TYPE_REGULAR;
+        entry->size = S_ISDIR(host.st_mode) ? 0 : host.st_size;
+        entry->parent = parent;
+        entry->slot = entries++;
+        if (entry->hostPath == NULL) {
+            stats_syscall();
+            closedir(dir);
+            return handleError("make_fs_from - could not list source entries");
+        }
 
-    //checks how full this data block is - this will determine how much we can write
-    size_t dataSize = strlen(store->data);
-    size_t spaceLeft = BLOCK_SIZE - dataSize;
+        if (entry->type == FILE_TYPE_DIRECTORY) {
+            int held = build_scan(build, path, index);
+            if (held == ERR) {
+                stats_syscall();
+                closedir(dir);
+                return ERR;
+            }
+            build->entries[index].size = (int64_t) held * FILE_ENTRY_SIZE;  //the list may have moved while scanning
+        }
+    }
+    stats_syscall();
+    closedir(dir);
+    return entries;
+}
 
-    //if space is 0 tries to move to the next block owned by this file
-    if (spaceLeft == 0) spaceLeft = nextNonFullBlock(&currentIndex, &store);
-    if (spaceLeft == -1) return writenTotal;
+//number of blocks an entry of the given size takes, an empty one still has its first block
+int64_t build_blocksFor(int64_t size, int blockSize) {
+    return size == 0 ? 1 : (size + blockSize - 1) / blockSize;
+}
 
-    size_t blockCounter = dataSize; //counter for writing the current block byte
-    size_t bufferCounter = dataSize; //counter for writing the current buffer byte
+//FAT index of the given block of an entry, its blocks follow on from its first except over the index a FAT-8 table reads as free
+int build_blockIndex(imageBuild *build, buildEntry *entry, int64_t blockNumber) {
+    int64_t index = entry->first + blockNumber;
+    if (build->narrowFat && entry->first < FAT8_FREE && index >= FAT8_FREE) index++;
+    return (int) index;
+}
 
-    while (writenTotal != nbytes) {
-        store->data[blockCounter] = writeData[bufferCounter];
-        writenTotal++;
-        desc->fp++;
-        if(store->data[blockCounter] == '\0') desc->represents->size++;
-        spaceLeft--;
-        blockCounter++;
-        bufferCounter++;
+/*
+ * writes bytes of an entry, from offset within it, to its blocks of the image
+ * its blocks are neighbours so this is one write, or two where a FAT-8 image skips an index
+ */
+int build_write(imageBuild *build, buildEntry *entry, const char *buffer, size_t bytes, off_t offset) {
+    int blockSize = build->blockSize;
+    while (bytes > 0) {
+        int index = build_blockIndex(build, entry, offset / blockSize);
+        size_t span = bytes;
+        if (build->narrowFat && index < FAT8_FREE) {
+            size_t beforeGap = (size_t) (FAT8_FREE - index) * blockSize - offset % blockSize;
+            if (span > beforeGap) span = beforeGap;
+        }
+        off_t at = build->dataOffset + (off_t) index * blockSize + offset % blockSize;
+        stats_syscall();
+        ssize_t writen = pwrite(build->imageFd, buffer, span, at);
+        if (writen <= 0) return handleError("make_fs_from - could not write data region");
+        buffer += writen;
+        bytes -= writen;
+        offset += writen;
+    }
+    return SUC;
+}
 
+//copies the contents of an entry into the image, a directory's from its serialized entries and a file's from its source
+int build_copy(imageBuild *build, buildEntry *entry, char *buffer) {
+    if (entry->type == FILE_TYPE_DIRECTORY) return build_write(build, entry, entry->content, entry->size, 0);
+
+    stats_syscall();
+    int source = open(entry->hostPath, O_RDONLY);
+    if (source == ERR) return handleError("make_fs_from - could not open source file");
+    off_t offset = 0;
+    int res = SUC;
+    while (offset < entry->size && res == SUC) {
+        size_t want = entry->size - offset < TRANSFER_BATCH_BYTES ? entry->size - offset : TRANSFER_BATCH_BYTES;
+        stats_syscall();
+        ssize_t got = pread(source, buffer, want, offset);
+        if (got <= 0) res = handleError("make_fs_from - source file changed while it was copied");
+        else res = build_write(build, entry, buffer, got, offset);
+        offset += got;
+    }
+    stats_syscall();
+    close(source);
+    return res;
+}
 
-        if (spaceLeft == 0) spaceLeft = nextNonFullBlock(&currentIndex, &store);
-        if (spaceLeft == -1) break;  //stop writing if there is no space
-        blockCounter = strlen(store->data);
+//worker thread of a build, takes entries in turn until none are left and copies each into the image
+void *build_worker(void *arg) {
+    imageBuild *build = arg;
+    char *buffer = malloc(TRANSFER_BATCH_BYTES);
+    for (;;) {
+        pthread_mutex_lock(&build->lock);
+        int index = buffer == NULL || build->failed ? build->count : build->next++;
+        if (buffer == NULL) build->failed = TRUE;
+        pthread_mutex_unlock(&build->lock);
+        if (index >= build->count) break;
+
+        if (build_copy(build, &build->entries[index], buffer) == ERR) {
+            pthread_mutex_lock(&build->lock);
+            build->failed = TRUE;
+            pthread_mutex_unlock(&build->lock);
+        }
     }
-    return writenTotal;
+    free(buffer);
+    return NULL;
 }
 
 /*
- * function for moving to the next index in a chain to the
- * given index. Takes in the address of the index so it
- * can be updated without returning it
- *
- * returns the next block's address or NULL
- * if the end of the chain has been reached
+ * gives every entry of the build its blocks, one run after another in the order they were listed, and links their chains
+ * then records each entry in its directory, the root directory's struct or the serialized entries of a subdirectory
  */
-block *nextOwnedBlock(int *currentIndex) {
-    char current = table->table[*currentIndex];
-    if(current == '\0') {
-        fprintf(stderr, "reached end of chain for this file\n");
-        usleep(SLEEP_USECS);
-        return NULL;
+int build_layout(fileSystem *volume, imageBuild *build) {
+    int blockSize = build->blockSize;
+    int next = FIRST_FAT_INDEX;
+    for (int i = 0; i < build->count; i++) {
+        buildEntry *entry = &build->entries[i];
+        if (build->narrowFat && next == FAT8_FREE) next++;
+        entry->first = next;
+        int64_t blocks = build_blocksFor(entry->size, blockSize);
+        int last = build_blockIndex(build, entry, blocks - 1);
+        for (int64_t b = 0; b < blocks - 1; b++) fat_set(volume, build_blockIndex(build, entry, b), build_blockIndex(build, entry, b + 1));
+        fat_set(volume, last, FAT_END);
+        next = last + 1;
+
+        if (entry->type == FILE_TYPE_DIRECTORY) {
+            entry->content = calloc(1, entry->size > 0 ? entry->size : 1);
+            if (entry->content == NULL) return handleError("make_fs_from - could not allocate directory entries");
+        }
+
+        file record;
+        set_file(&record, entry->name, entry->first, entry->size);
+        record.type = entry->type;
+        record.tailIndex = last;
+        record.tailUsed = entry->size == 0 ? 0 : (int32_t) ((entry->size - 1) % blockSize + 1);
+        if (entry->parent == -1) {
+            dir_setEntry(volume, entry->slot, entry->name, entry->first, entry->type, entry->size);
+            *volume->dir->files[entry->slot] = record;
+            volume->dir->storing++;
+        } else {
+            buildEntry *parent = &build->entries[entry->parent];
+            serialize(entryLayout, FIELD_COUNT(entryLayout), &record, parent->content + (entry->slot * FILE_ENTRY_SIZE));
+        }
     }
-    int blockLocation = *currentIndex; //store index of block
-    *currentIndex = table->table[*currentIndex];    //make currentIndex next index in chain
-    return storage->blocks[blockLocation];  //return found block
+    return SUC;
 }
 
 /*
- * takes in the offset the block you are moving through and the fp you are moving
- * it then find how much space is in the current block and how much is left to reach the offset
- * then if the entire current block's data will perfectly reach the offset or not reach the offset
- * then the whole block's length can be added to the file pointer - return holds -
- * otherwise we go one byte at a tie until the offset is reached and return
- * the number of bytes forward we read - return read -
- * if the the offset is somehow not less than, equal to or greater than the
- * amount of data held in the file then it returns an error as maths has failed us
- *
- * originally only let you move o written bytes to re-set to this, make holds = strlen(current->data)
-*/
-off_t movePointer(off_t offset, block *current, off_t fp) {
-    if(current == NULL) return handleError("cannot move pointer - invalid block received");
-    size_t holds = BLOCK_SIZE;
-    off_t remaining = offset - fp;
-    int read = 0;
-
-    if(remaining >= holds) {   //if we have space to add the entire block content to the fp
-        return holds;
-    }
-    else if(remaining < holds) { //if we can only add some of the block to the fp
-        while(read != offset) { //update the fp until you reach the
-            read++;
+ * builds the image once its entries are listed: sizes it to fit them, lays them out, has threads worker
+ * threads copy their contents into the data region, then writes the volume boot record, FAT and directory
+ * every byte of the image is written once, and the data region as long sequential runs
+ */
+int build_image(fileSystem *volume, imageBuild *build, int fd, int blockSize, int maxFiles, int spareBlocks, int threads) {
+    int rootEntries = 0;
+    int64_t blocks = FIRST_FAT_INDEX + (int64_t) spareBlocks;
+    for (int i = 0; i < build->count; i++) {
+        if (build->entries[i].parent == -1) rootEntries++;
+        blocks += build_blocksFor(build->entries[i].size, blockSize);
+    }
+    if (maxFiles < rootEntries) maxFiles = rootEntries;
+    if (blocks > FAT8_FREE && blocks <= MAX_FAT8_ENTRIES) blocks++;    //a FAT-8 image never uses the index read as free
+    if (blocks > MAX_FAT32_ENTRIES) return handleError("make_fs_from - source tree is too large for an image");
+
+    if (initialise_regions(volume, blockSize, (int) blocks, maxFiles) == ERR) return ERR;
+    build->imageFd = fd;
+    build->blockSize = blockSize;
+    build->dataOffset = volume->layout.dataOffset;
+    build->narrowFat = volume->vmb->fatWidth == FAT_WIDTH_8;
+    if (build_layout(volume, build) == ERR) return ERR;
+    stats_syscall();
+    if (ftruncate(fd, volume->layout.imageSize) == ERR) return handleError_p("make_fs_from - could not size image");
+
+    if (threads < 1) threads = 1;
+    if (threads > BUILD_THREADS_MAX) threads = BUILD_THREADS_MAX;
+    if (threads > build->count) threads = build->count;
+    pthread_t workers[BUILD_THREADS_MAX];
+    int started = 0;
+    while (started < threads && pthread_create(&workers[started], NULL, build_worker, build) == SUC) started++;
+    if (started == 0) build_worker(build);  //copy on this thread if none could be started
+    for (int i = 0; i < started; i++) pthread_join(workers[i], NULL);
+    if (build->failed) return ERR;
+
+    return write_regions(volume, fd);
+}
+
+/*
+ * Function for generating a file system holding a copy of a host directory tree
+ * the tree is listed first so the image can be sized to fit it (with spareBlocks free blocks to grow into)
+ * then each file and directory is given one contiguous run of blocks and its data copied in by a pool of threads,
+ * which read the source files side by side and write each into its place in the image (see build_image)
+ * the image is built in a volume of its own as with make_fs
+ * returns 0 or -1 if the tree cannot be read or the image cannot be written
+ */
+int make_fs_from(char *store_name, char *source_dir, int blockSize, int maxFiles, int spareBlocks, int threads) {
+    if (store_name == NULL || source_dir == NULL) return handleError("make_fs_from - no image or source directory given");
+    if (spareBlocks < 0) return handleError("make_fs_from - invalid geometry - spare blocks must not be negative");
+
+    imageBuild *build = new_imageBuild();
+    if (build == NULL) return handleError("make_fs_from - could not allocate build");
+    if (build_scan(build, source_dir, -1) == ERR) {
+        free_imageBuild(build);
+        return ERR;
+    }
+
+    stats_syscall();
+    int fd = open(store_name, O_RDWR | O_CREAT | O_TRUNC, 0777);
+    fileSystem *building = new_fileSystem(NULL, NULL, NULL, NULL);
+    int res = ERR;
+    if (fd == ERR) handleError("make_fs_from - could not create or open store file");
+    else if (building == NULL) handleError("make_fs_from - could not allocate volume");
+    else {
+        res = build_image(building, build, fd, blockSize, maxFiles, spareBlocks, threads);
+    }
+
+    free_fileSystem(building);
+    free_imageBuild(build);
+    if (fd != ERR) {
+        stats_syscall();
+        close(fd);
+    }
+    return res;
+}
+
+// host transfer functions
+
+//TRUE if the image on disk holds the current contents of count blocks from first, a mapped image always does
+int run_isClean(fileSystem *volume, int first, int count) {
+    if (volume->image != NULL) return TRUE;
+    pthread_mutex_lock(&volume->metaLock);
+    int clean = TRUE;
+    for (int i = first; i < first + count && clean; i++) {
+        if (volume->storage->dirty->flags[i]) clean = FALSE;
+    }
+    pthread_mutex_unlock(&volume->metaLock);
+    return clean;
+}
+
+/*
+ * writes bytes from the start of block first to a host fd, the blocks of a run are neighbours in memory and in the image
+ * a run already on disk is moved kernel side with sendfile, anything sendfile cannot do is written from memory
+ */
+int run_export(fileSystem *volume, int hostFd, int first, size_t bytes, int clean) {
+    char *data = volume->storage->blocks[first]->data;
+    size_t done = 0;
+
+#ifdef __linux__
+    off_t at = volume->layout.dataOffset + ((off_t) first * volume->storage->blockSize);
+    while (clean && done != bytes) {
+        stats_syscall();
+        ssize_t sent = sendfile(hostFd, volume->filedes, &at, bytes - done);
+        if (sent <= 0) break;   //the rest is written from memory below
+        done += sent;
+    }
+#else
+    (void) clean;
+#endif
+
+    while (done != bytes) {
+        stats_syscall();
+        ssize_t writen = write(hostFd, data + done, bytes - done);
+        if (writen == ERR) return handleError("cannot export file - could not write to host file");
+        done += writen;
+    }
+    return SUC;
+}
+
+#ifdef __linux__
+/*
+ * copies a host fd into the vectors of an import batch kernel side with copy_file_range, for a mapped image only
+ * the mapping shares its pages with the image file so the copied data shows through it without touching user space
+ * (a buffered volume's blocks would be left stale)
+ * if the kernel cannot copy between the two files (EXDEV, EINVAL and the like) before anything is copied,
+ * kernelCopy is cleared so this batch and the rest of the import are read with readv instead
+ * returns the number of bytes copied, or ERR if the copy fails
+ */
+ssize_t import_copyRange(fileSystem *volume, int hostFd, struct iovec *vectors, int count, char *kernelCopy) {
+    size_t copied = 0;
+    for (int i = 0; i < count; i++) {
+        //vectors whose blocks are neighbours in the image are copied as one range
+        char *from = vectors[i].iov_base;
+        size_t length = vectors[i].iov_len;
+        while (i + 1 < count && (char *) vectors[i + 1].iov_base == from + length) length += vectors[++i].iov_len;
+
+        off_t at = from - volume->image;    //the mapping covers the image from its start
+        size_t done = 0;
+        while (done < length) {
+            stats_syscall();
+            ssize_t moved = copy_file_range(hostFd, NULL, volume->filedes, &at, length - done, 0);
+            if (moved == ERR && copied + done == 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+                *kernelCopy = FALSE;
+                return 0;
+            }
+            if (moved == ERR) return copied + done > 0 ? (ssize_t) (copied + done) : ERR;   //a short batch, the next one reports the error
+            if (moved == 0) return copied + done;   //the end of the host file
+            done += moved;
+        }
+        copied += done;
+    }
+    return copied;
+}
+#endif
+
+/*
+ * reads the next batch of a host fd straight into a writer's file, without a buffer in between
+ * what is left of the tail block and the blocks linked on after it make up the vectors, then any linked block
+ * the read did not reach is unlinked and freed again so the file ends where the data does
+ * the vectors are filled kernel side with copy_file_range while kernelCopy is set (see import_copyRange),
+ * otherwise with one readv
+ * at most want bytes are read, so blocks are only linked for data the host file is known to hold
+ * returns the number of bytes read (0 at the end of the host file or once the volume is full), or ERR if the read fails
+ */
+ssize_t import_batch(fileSystem *volume, descriptor *desc, int hostFd, size_t want, char *kernelCopy) {
+    file *writeTo = desc->represents;
+    int blockSize = volume->storage->blockSize;
+    int tail = writeTo->tailIndex, used = writeTo->tailUsed;    //where the file ended before the batch
+
+    int blocks[IOV_MAX];
+    struct iovec vectors[IOV_MAX];
+    int count = 0;
+    size_t planned = 0;
+    if (used < blockSize) {
+        blocks[count] = tail;
+        vectors[count++] = (struct iovec) {volume->storage->blocks[tail]->data + used, blockSize - used};
+        planned += blockSize - used;
+    }
+    writeBatch batch = {0};
+    while (count < IOV_MAX && planned < want) {
+        //only as many blocks are linked as there are vectors left for, so each one linked is listed below
+        int wanted = (int) ((want - planned + blockSize - 1) / blockSize);
+        if (wanted > IOV_MAX - count) wanted = IOV_MAX - count;
+        if (batch.linkedNext == batch.linkedCount && file_extendTail(volume, desc, &batch, wanted) == ERR) break;
+        int next = batch.linked[batch.linkedNext++];
+        writeTo->tailIndex = next;  //the next batch is linked on after it
+        blocks[count] = next;
+        vectors[count++] = (struct iovec) {volume->storage->blocks[next]->data, blockSize};
+        planned += blockSize;
+    }
+    if (count == 0) return 0;
+    if (planned > want) vectors[count - 1].iov_len -= planned - want;
+
+    ssize_t got = ERR;
+#ifdef __linux__
+    if (*kernelCopy) got = import_copyRange(volume, hostFd, vectors, count, kernelCopy);
+#else
+    *kernelCopy = FALSE;
+#endif
+    if (!*kernelCopy) {
+        stats_syscall();
+        got = readv(hostFd, vectors, count);
+    }
+    size_t landed = got > 0 ? got : 0;
+
+    //the file's new tail is the last block the read reached, or the old tail if it reached none
+    int last = -1;
+    size_t left = landed;
+    for (int i = 0; i < count && left > 0; i++) {
+        size_t fill = vectors[i].iov_len < left ? vectors[i].iov_len : left;
+        left -= fill;
+        last = i;
+        writeTo->tailUsed = (blocks[i] == tail ? used : 0) + fill;
+    }
+    writeTo->tailIndex = last == -1 ? tail : blocks[last];
+    if (last == -1) writeTo->tailUsed = used;
+    __atomic_store_n(&writeTo->size, writeTo->size + landed, __ATOMIC_RELAXED);
+
+    pthread_mutex_lock(&volume->metaLock);
+    for (int i = 0; i <= last; i++) markDirty(volume->storage->dirty, blocks[i]);
+    if (last != count - 1) {
+        fat_set(volume, writeTo->tailIndex, FAT_END);
+        for (int i = last + 1; i < count; i++) {
+            if (blocks[i] != tail) fat_set(volume, blocks[i], FAT_FREE);
         }
-        return read;
     }
-    return ERR; //should never reach here, all cases covered
+    pthread_mutex_unlock(&volume->metaLock);
+
+    //the block map must not hold blocks that were given back
+    int fileBlocks = writeTo->size == 0 ? 1 : (int) ((writeTo->size - 1) / blockSize + 1);
+    pthread_mutex_lock(&desc->mapLock);
+    if (desc->mapLength > fileBlocks) desc->mapLength = fileBlocks;
+    pthread_mutex_unlock(&desc->mapLock);
+
+    if (got == ERR) return handleError("cannot import file - could not read from host file");
+    return landed;
+}
+
+/*
+ * Function for copying a file out of the volume to a host file descriptor, written from its current position
+ * the file is walked a run of neighbouring blocks at a time, each run on disk is sent kernel side from the image
+ * (see run_export) so a file laid out in extents costs a few sendfile calls and no copies through a buffer
+ * returns the number of bytes copied, or ERR if the file cannot be opened for reading or the host write fails
+ */
+ssize_t exportFile(fileSystem *volume, char *name, int hostFd) {
+    if (volume_check(volume) == ERR) return ERR;
+    meta_lock(volume);
+    int fd = openFile(volume, name, O_RDONLY);
+    meta_unlock(volume);
+    if (fd == ERR) return ERR;
+
+    descriptor *desc = desc_acquire(volume, fd, O_RDONLY, FALSE);
+    if (desc == NULL) return ERR;
+    int blockSize = volume->storage->blockSize;
+    off_t size = desc->represents->size;
+
+    off_t offset = 0;
+    int res = SUC;
+    while (offset < size && res == SUC) {
+        //gather the run of blocks that follow on from each other
+        int first = desc_blockAt(volume, desc, (int) (offset / blockSize));
+        if (first == ERR) break;
+        int count = 1;
+        while (offset + (off_t) count * blockSize < size && desc_blockAt(volume, desc, (int) (offset / blockSize) + count) == first + count) count++;
+
+        off_t end = offset + (off_t) count * blockSize;
+        size_t bytes = (end < size ? end : size) - offset;
+        res = run_export(volume, hostFd, first, bytes, run_isClean(volume, first, count));
+        if (res == SUC) offset += bytes;
+    }
+
+    desc_release(volume, desc, FALSE);
+    volume_lock(volume, FALSE);
+    closeFile(volume, fd);
+    volume_unlock(volume);
+    return res == ERR ? ERR : offset;
+}
+
+//runs exportFile, timing the call for fs_stats
+ssize_t fs_export(fileSystem *volume, char *name, int hostFd) {
+    uint64_t start = stats_start();
+    return stats_done(STATS_EXPORT, start, exportFile(volume, name, hostFd));
+}
+
+/*
+ * Function for copying a host file descriptor, from its current position to its end, into a new file of the volume
+ * the file is created (replacing any file of the same name) and the host data is read straight into its blocks
+ * a batch at a time (see import_batch), then it is closed, which syncs it like any other write
+ * on Linux a mapped image is filled with copy_file_range, which can share or offload the copy within one file system
+ * a regular host file is copied up to the size it has when the import starts, anything else until it reads empty
+ * returns the number of bytes copied (short if the volume fills), or ERR if the file cannot be created or the read fails
+ */
+ssize_t importFile(fileSystem *volume, int hostFd, char *name) {
+    if (volume_check(volume) == ERR) return ERR;
+    meta_lock(volume);
+    int fd = createFile(volume, name);
+    meta_unlock(volume);
+    if (fd == ERR) return ERR;
+
+    descriptor *desc = desc_acquire(volume, fd, O_WRONLY, TRUE);
+    if (desc == NULL) return ERR;
+
+    //the bytes left in a regular host file bound each batch, other fds are read until they run dry
+    struct stat host;
+    stats_syscall();
+    off_t start = lseek(hostFd, 0, SEEK_CUR);
+    stats_syscall();
+    off_t remaining = fstat(hostFd, &host) == SUC && S_ISREG(host.st_mode) && start != ERR ? host.st_size - start : -1;
+
+    ssize_t total = 0, got = 0;
+    char kernelCopy = volume->image != NULL;
+    while (remaining != 0) {
+        size_t want = remaining < 0 || remaining > TRANSFER_BATCH_BYTES ? TRANSFER_BATCH_BYTES : (size_t) remaining;
+        if ((got = import_batch(volume, desc, hostFd, want, &kernelCopy)) <= 0) break;
+        total += got;
+        if (remaining > 0) remaining -= got;
+    }
+    desc->fp = desc->represents->size;
+    file_store(volume, desc->node, NULL);
+
+    desc_release(volume, desc, TRUE);
+    volume_lock(volume, FALSE);
+    int closed = closeFile(volume, fd);
+    volume_unlock(volume);
+    return got == ERR || closed == ERR ? ERR : total;
+}
+
+//runs importFile, timing the call for fs_stats
+ssize_t fs_import(fileSystem *volume, int hostFd, char *name) {
+    uint64_t start = stats_start();
+    return stats_done(STATS_IMPORT, start, importFile(volume, hostFd, name));
+}
+
+/*
+ * Function for reading data from the given offset of a file without using or moving its file pointer
+ * so threads can read separate ranges of a file through one descriptor
+ * returns the number of bytes read (0 at or past the end of the file), or ERR if:
+ *      the offset is negative
+ *      file is not open
+ *      file is not open for reading
+ */
+ssize_t fs_pread(fileSystem *volume, int fd, void *buffer, size_t nbytes, off_t offset) {
+    uint64_t start = stats_start();
+    if (offset < 0) return stats_done(STATS_READ, start, handleError("cannot read file - invalid offset: negative value"));
+    descriptor *desc = desc_acquire(volume, fd, O_RDONLY, FALSE);
+    if (desc == NULL) return stats_done(STATS_READ, start, ERR);
+
+    size_t readTotal = desc_readAt(volume, desc, (char *) buffer, nbytes, offset);
+    desc_release(volume, desc, FALSE);
+    return stats_done(STATS_READ, start, readTotal);
+}
+
+/*
+ * Function for writing data at the given offset of a file without using or moving its file pointer
+ * the offset may be anywhere up to the end of the file, writing at the end appends
+ * returns the number of bytes written, or ERR if:
+ *      the offset is negative or past the end of the file
+ *      file is not open
+ *      file is not open for writing
+ */
+ssize_t fs_pwrite(fileSystem *volume, int fd, void *buffer, size_t nbytes, off_t offset) {
+    uint64_t start = stats_start();
+    if (offset < 0) return stats_done(STATS_WRITE, start, handleError("cannot write file - invalid offset: negative value"));
+    descriptor *desc = desc_acquire(volume, fd, O_WRONLY, FALSE);
+    if (desc == NULL) return stats_done(STATS_WRITE, start, ERR);
+    if (offset > desc->represents->size) {
+        desc_release(volume, desc, FALSE);
+        return stats_done(STATS_WRITE, start, handleError("cannot write file - invalid offset: offset is past the end of the file"));
+    }
+
+    writeBatch batch = {0};
+    size_t writenTotal = desc_writeAt(volume, desc, &batch, (char *) buffer, nbytes, offset);
+    if (writenTotal > 0) file_store(volume, desc->node, &batch);
+    desc_release(volume, desc, FALSE);
+    return stats_done(STATS_WRITE, start, writenTotal);
+}
+
+/*
+ * Function for reading from the file pointer into each buffer of an iovec array in turn
+ * the descriptor is checked once and each segment carries on from where the last one stopped,
+ * so a record split over several buffers costs one call
+ * returns the total number of bytes read (short once the end of the file is reached), or ERR if:
+ *      the vector count is negative
+ *      file is not open
+ *      file is not open for reading
+ */
+ssize_t fs_readv(fileSystem *volume, int fd, const struct iovec *iov, int iovcnt) {
+    uint64_t start = stats_start();
+    if (iovcnt < 0) return stats_done(STATS_READ, start, handleError("cannot read file - invalid vector count"));
+    descriptor *desc = desc_acquire(volume, fd, O_RDONLY, TRUE);
+    if (desc == NULL) return stats_done(STATS_READ, start, ERR);
+
+    size_t readTotal = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        size_t read = desc_readAt(volume, desc, (char *) iov[i].iov_base, iov[i].iov_len, desc->fp);
+        desc->fp += read;
+        readTotal += read;
+        if (read != iov[i].iov_len) break;  //reached the end of the file
+    }
+
+    desc_release(volume, desc, TRUE);
+    return stats_done(STATS_READ, start, readTotal);
+}
+
+/*
+ * Function for writing each buffer of an iovec array in turn at the file pointer
+ * the descriptor is checked once, each segment carries on in the block the last one
+ * finished in, and the entry is stored once at the end rather than once per segment
+ * returns the total number of bytes written (short if the file system fills), or ERR if:
+ *      the vector count is negative
+ *      file is not open
+ *      file is not open for writing
+ */
+ssize_t fs_writev(fileSystem *volume, int fd, const struct iovec *iov, int iovcnt) {
+    uint64_t start = stats_start();
+    if (iovcnt < 0) return stats_done(STATS_WRITE, start, handleError("cannot write file - invalid vector count"));
+    descriptor *desc = desc_acquire(volume, fd, O_WRONLY, TRUE);
+    if (desc == NULL) return stats_done(STATS_WRITE, start, ERR);
+
+    writeBatch batch = {0};
+    size_t writenTotal = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        size_t writen = desc_writeAt(volume, desc, &batch, (char *) iov[i].iov_base, iov[i].iov_len, desc->fp);
+        desc->fp += writen;
+        writenTotal += writen;
+        if (writen != iov[i].iov_len) break;    //no file space remaining
+    }
+
+    if (writenTotal > 0) file_store(volume, desc->node, &batch);
+    desc_release(volume, desc, TRUE);
+    return stats_done(STATS_WRITE, start, writenTotal);
 }
 
+/*
+ * finds the FAT index of the given block of a descriptor's file through its block map
+ * the map is extended by following the chain on from the last block it holds, so each link is
+ * followed once per descriptor and every later lookup is a single array read
+ * (while a file is open its chain only ever grows so the map never goes stale)
+ * calls sharing a descriptor may look up blocks at once so the map is read under its own lock
+ * returns ERR when the chain is shorter than that
+ */
+int desc_blockAt(fileSystem *volume, descriptor *desc, int blockNumber) {
+    int found = ERR;
+    pthread_mutex_lock(&desc->mapLock);
+
+    while (desc->mapLength <= blockNumber) {
+        if (desc->mapLength == desc->mapCapacity) {
+            int capacity = desc->mapCapacity == 0 ? BLOCK_MAP_MIN : desc->mapCapacity * 2;
+            int *grown = realloc(desc->blockMap, capacity * sizeof(int));
+            if (grown == NULL) {
+                pthread_mutex_unlock(&desc->mapLock);
+                return handleError("desc_blockAt - could not grow block map");
+            }
+            desc->blockMap = grown;
+            desc->mapCapacity = capacity;
+        }
+
+        if (desc->mapLength == 0) {
+            desc->blockMap[desc->mapLength++] = desc->represents->fatIndex;
+            continue;
+        }
+
+        //a chain never has more blocks than the table has indexes, anything longer is cyclic
+        uint32_t next = fat_get(volume, desc->blockMap[desc->mapLength - 1]);
+        if (next == FAT_END) break;
+        if (!fat_isLink(volume, next) || desc->mapLength >= volume->table->entries) {
+            pthread_mutex_unlock(&desc->mapLock);
+            return handleError("desc_blockAt - chain is damaged");
+        }
+        desc->blockMap[desc->mapLength++] = next;
+    }
+
+    if (blockNumber < desc->mapLength) found = desc->blockMap[blockNumber];
+    pthread_mutex_unlock(&desc->mapLock);
+    return found;
+}
 
 /*
  * This function takes in a file descriptor and an offset and moves
@@ -916,112 +3465,139 @@ off_t movePointer(off_t offset, block *current, off_t fp) {
  * checks that the system is mounted and the file descriptor
  * points to an open file then uses the fd to get the file pointer
  *
- * sets the pointer to 0 to signify the start of the file,
- * finds the file the descriptor represents and it's first fat index
- * then moves forward as many bytes are in their first block,
- * if that does not reach the offset it finds the next
+ * the offset may be anywhere up to the end of the file, the block it falls in is found
+ * through the descriptor's block map so a seek costs one lookup once the map reaches it
+ * (the block holding the file pointer is then always blockMap[fp / blockSize])
  */
-int fs_lseek(int fd, off_t offset) {
-    if(offset < 0) return handleError("cannot move file pointer - invalid offset: negative value");
-    if(!mounted) return handleError("cannot move file pointer - System is not mounted");
-    if(fds[fd] == NULL) return handleError("cannot move file pointer - file i snot open");
-
-    descriptor *desc = fds[fd];
-    off_t fp = 0; //start from beginning of file
-    file *toShift = desc->represents;
-    int fatIndex = toShift->fatIndex;
-    block *current = storage->blocks[fatIndex];
-
-    fp += movePointer(offset, current, fp);
-
-    while(fp != offset) {   //not yet reached desired offset in file
-        current = nextOwnedBlock(&fatIndex);    //move to next block
-        if(current == NULL) return handleError("cannot move file pointer - invalid offset: offset exceeds file memory");
-
-        fp += movePointer(offset, current, fp);
+off_t fs_lseek(fileSystem *volume, int fd, off_t offset) {
+    uint64_t start = stats_start();
+    if(offset < 0) return stats_done(STATS_LSEEK, start, handleError("cannot move file pointer - invalid offset: negative value"));
+    if(volume_check(volume) == ERR) return stats_done(STATS_LSEEK, start, ERR);
+
+    //a seek only reads the file so it takes its lock shared whatever the descriptor's mode
+    volume_lock(volume, FALSE);
+    descriptor *desc = volume->mounted ? desc_take(volume, fd) : NULL;
+    if(desc == NULL) {
+        volume_unlock(volume);
+        return stats_done(STATS_LSEEK, start, handleError(volume->mounted ? "cannot move file pointer - file is not open" : "cannot move file pointer - System is not mounted"));
     }
 
-    //reached offset - update file descriptor and return offset
-    desc->fp = fp;
-    return fp;
+    pthread_mutex_lock(&desc->posLock);
+    pthread_rwlock_rdlock(&desc->node->lock);
+
+    //the end of a block counts as part of it so a file pointer can sit at the end of the file
+    off_t last = offset == 0 ? 0 : (offset - 1) / volume->storage->blockSize;
+    char *invalid = NULL;
+    if(offset > desc->represents->size)
+        invalid = "cannot move file pointer - invalid offset: offset is past the end of the file";
+    else if(desc_blockAt(volume, desc, (int) last) == ERR)
+        invalid = "cannot move file pointer - invalid offset: offset exceeds file memory";
+    else desc->fp = offset; //reached offset - update file descriptor
+
+    pthread_rwlock_unlock(&desc->node->lock);
+    pthread_mutex_unlock(&desc->posLock);
+    desc_drop(volume, desc);
+    volume_unlock(volume);
+
+    if(invalid != NULL) return stats_done(STATS_LSEEK, start, handleError(invalid));
+    return stats_done(STATS_LSEEK, start, offset);
 }
 
 
 //test functions
 
-void printDirectory() {
-    for (int i = 0; i < MAX_ENTRIES; i++) {
-        if(rootDir != NULL) {
-            file *current = rootDir->files[i];
+void printDirectory(fileSystem *volume) {
+    if (volume_check(volume) == ERR) return;
+    for (int i = 0; volume->dir != NULL && i < volume->dir->capacity; i++) {
+        if(volume->dir != NULL) {
+            file *current = volume->dir->files[i];
             printf("file %d\n", i + 1);
             printf("name: %s\n", current->name);
             printf("index: %d\n", current->fatIndex);
-            printf("size: %d\n", current->size);
+            if (current->type == FILE_TYPE_DIRECTORY) printf("type: directory\n");
+            printf("size: %lld\n", (long long) current->size);
         }
     }
     printf("----------\n");
 }
 
-void printVolumeBoot() {
-    if(vmb != NULL) {
+void printVolumeBoot(fileSystem *volume) {
+    if (volume_check(volume) == ERR) return;
+    if(volume->vmb != NULL) {
         printf("volume boot\n");
-        printf("identifier number %d\n", vmb->fsId);
-        printf("block size %d\n", vmb->blockSize);
-        printf("max files %d\n", vmb->maxFiles);
+        printf("identifier number %d\n", volume->vmb->fsId);
+        printf("block size %d\n", volume->vmb->blockSize);
+        printf("max files %d\n", volume->vmb->maxFiles);
+        printf("block count %d\n", volume->vmb->blockCount);
+        printf("FAT width %d\n", volume->vmb->fatWidth);
         printf("----------\n");
     }
 }
 
-void printFAT() {
-    for (int i = FIRST_FAT_INDEX; i <= LAST_FAT_INDEX; i++) {
-        if(table != NULL) printf("FAT section %d (index %d) holds %c\n", i + 1, i, table->table[i]);
+void printFAT(fileSystem *volume) {
+    if (volume_check(volume) == ERR) return;
+    for (int i = FIRST_FAT_INDEX; volume->table != NULL && i < volume->table->entries; i++) {
+        uint32_t value = fat_get(volume, i);
+        if(value == FAT_FREE) printf("FAT section %d (index %d) is free\n", i + 1, i);
+        else if(value == FAT_END) printf("FAT section %d (index %d) ends its chain\n", i + 1, i);
+        else if(value == FAT_RESERVED) printf("FAT section %d (index %d) is reserved\n", i + 1, i);
+        else printf("FAT section %d (index %d) holds %u\n", i + 1, i, value);
 
     }
     printf("----------\n");
 }
 
-void printDataRegion() {
-    for (int i = 0; i < FAT_TABLE_SIZE; i++) {
-        if(storage != NULL) printf("block %d holds: %s\n", i, storage->blocks[i]->data);
+void printDataRegion(fileSystem *volume) {
+    if (volume_check(volume) == ERR) return;
+    for (int i = 0; volume->storage != NULL && i < volume->storage->count; i++) {
+        if(volume->storage != NULL) printf("block %d holds: %.*s\n", i, volume->storage->blockSize, volume->storage->blocks[i]->data);
     }
     printf("----------\n");
 }
 
-int incrementFileSize(char *name) {
-    int update = dir_search(name);
+int incrementFileSize(fileSystem *volume, char *name) {
+    if (volume_check(volume) == ERR) return ERR;
+    int update = dir_search(volume, name);
 
     if (update == ERR) return handleError("cannot increment file's size - file does not exist");
 
     else {
-        rootDir->files[update]->size++;
+        volume->dir->files[update]->size++;
         return SUC;
     }
 }
 
-int manualBlockSet(int fd, char *setTo) {
-    if(strlen(setTo) > BLOCK_SIZE) return handleError("too large for single block");
-    descriptor *d = fds[fd];
+int manualBlockSet(fileSystem *volume, int fd, char *setTo) {
+    if (volume_check(volume) == ERR) return ERR;
+    if(strlen(setTo) > (size_t) volume->storage->blockSize) return handleError("too large for single block");
+    descriptor *d = desc_take(volume, fd);
+    if(d == NULL) return handleError("cannot set block - file is not open");
     file *f = d->represents;
     int index = f->fatIndex;
-    block *b = storage->blocks[index];
+    block *b = volume->storage->blocks[index];
+    desc_drop(volume, d);
 
-    strcpy(b->data, setTo);
+    strncpy(b->data, setTo, volume->storage->blockSize);
+    markDirty(volume->storage->dirty, index);
 
     return SUC;
 }
 
-void printFileDescriptors() {
-    for (int i = 0; i < MAX_OPEN_FILES; i++) {
-        descriptor *current = fds[i];
+void printFileDescriptors(fileSystem *volume) {
+    if (volume_check(volume) == ERR) return;
+    pthread_mutex_lock(&volume->fdLock);
+    for (int i = 0; i < volume->fds->slots; i++) {
+        descriptor *current = fdTable_slot(volume, i)->desc;
         if (current != NULL) {
-            printf("file descriptor %d\n", i);
+            printf("file descriptor %d\n", fdTable_fd(volume, i));
             printf("represents file %s \n", current->represents->name);
             printf("starting at FAT index %d\n", current->represents->fatIndex);
-            printf("and of size %d\n", current->represents->size);
+            printf("and of size %lld\n", (long long) current->represents->size);
             printf("opened with mode %d\n", current->mode);
-            printf("with file pointer at byte %d of the disk file\n", current->fp);
+            printf("with file pointer at byte %lld of the disk file\n", (long long) current->fp);
             printf("--------------------\n");
         }
     }
+    pthread_mutex_unlock(&volume->fdLock);
     printf("/\\/\\/\\/\\/\\/\\/\\/\\/\\/\\/\\/\\/\\\n");
 }
\ No newline at end of file
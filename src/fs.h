@@ -5,9 +5,17 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
 #include <unistd.h>
 #include <sys/fcntl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 //result definitions
 #define SUC 0
@@ -19,87 +27,213 @@
 #define overwrite "w"
 #define append "a"
 
+//mount mode definitions
+#define MOUNT_BUFFERED 0  // each region is read into heap structs at mount and written back on sync
+#define MOUNT_MMAP 1      // the whole image is mapped and the region structs are views into the mapping
+#define MOUNT_MODE_MASK 0x0F
+
+//durability definitions, or'd with a mount mode to choose how a sync makes its writes durable
+#define DURABLE_FSYNC 0x00  // fsync the image on every sync (default)
+#define DURABLE_NONE 0x10   // leave flushing the image to the kernel
+#define DURABLE_DATA 0x20   // fdatasync the image (or msync its dirty pages when mapped) on every sync
+#define DURABLE_GROUP 0x30  // batch the syncs made within a commit window into one fdatasync, each waits for it
+#define DURABILITY_MASK 0x30
+#define GROUP_COMMIT_USECS 10000    // default commit window for DURABLE_GROUP
+
 //volume record definitions
-#define VOLUME_RECORD_SIZE 12    // size in bits of the volume record   (3 32 bit (4 bytes) values)
+#define VOLUME_RECORD_SIZE 20    // size in bytes of the volume record   (5 32 bit (4 bytes) values)
 #define IDENT 7     // used to identify the fs when checking it is mounted
-#define BLOCK_SIZE 25    // the size of each storage block
-#define MAX_ENTRIES 3   // the maximum number of entries to be stored in the root (only) directory
 
-//fat table definitions
-#define FAT_TABLE_SIZE 10 // remember 0 and 255 are reserved (so 256 becomes 254)
-#define FIRST_FAT_INDEX 0  //index of first non-reserved FAT index (technically 1 but that messes up the array)
-#define LAST_FAT_INDEX (FAT_TABLE_SIZE - 1) //index of last non-reserved FAT index
-
-//root directory definitions
-#define FILE_ENTRY_SIZE 36     //last value is 2bytes (16 bit) offset from 0 by 34 bytes
+//default geometry, the geometry of an image is chosen by make_fs and read back from its volume record
+#define DEFAULT_BLOCK_SIZE 25    // the size of each storage block
+#define DEFAULT_BLOCK_COUNT 10   // the number of blocks (and so FAT indexes) in the data region
+#define DEFAULT_MAX_ENTRIES 3   // the maximum number of entries to be stored in the root (only) directory
+
+//fat table definitions, the width of an image's table is recorded in its volume record
+#define FAT_WIDTH_8 8   // one byte per index
+#define FAT_WIDTH_32 32 // four bytes per index
+#define MAX_FAT8_ENTRIES 255 // each index is a byte and 255 is the reserved marker
+#define MAX_FAT32_ENTRIES INT32_MAX  // indexes are handled as ints
+#define FIRST_FAT_INDEX 1  //index of first non-reserved FAT index (0 would read as the end of a FAT-8 chain)
+#define FAT_FREE 0u    // value of a free FAT index
+#define FAT_END 0xFFFFFFFFu    // value of the last FAT index in a chain
+#define FAT_RESERVED 0xFFFFFFFEu   // value of a FAT index that can never be allocated
+#define FAT8_FREE '0'   // how a FAT-8 table stores each of the values above
+#define FAT8_END '\0'
+#define FAT8_RESERVED 0xFF
+#define FAT_SYNC_CHUNK 512  //number of FAT bytes covered by each dirty flag (a sector)
+#define MAP_WORD_BITS 64    //number of indexes covered by one word of the free-block bitmap
+#define RESERVE_AHEAD_BLOCKS 16 //length of the extent held free ahead of a file open for writing
+#define EXTENT_PROBES 64    //free runs examined when looking for a whole extent before settling for the longest
+#define BLOCK_MAP_MIN 16    //blocks a descriptor's block map has room for when it is first filled
+#define WRITE_BATCH_BLOCKS 64   //most blocks a write links on, or changes, per hold of the metadata lock
+
+//allocation definitions
+#define SLAB_CHUNK_OBJECTS 64   //objects a slab pool allocates at a time
+#define SLAB_ALIGN 16   //every object of a slab pool starts on a multiple of this many bytes
+
+//directory definitions, subdirectories hold the same entries as the root directory in their data blocks
+#define FILE_ENTRY_SIZE 56     //32 byte name, 4 byte FAT index, 4 byte type, the 8 byte (64 bit) size then the 4 byte tail index and used bytes
 #define FILE_NAME_SIZE 32
-#define FILE_METADATA_SIZE 2
-#define DIRECTORY_SIZE (MAX_ENTRIES * FILE_ENTRY_SIZE)  //max size (in bytes) of the root directory
-#define MAX_OPEN_FILES MAX_ENTRIES
-
-//data region definitions
-    //can hold 256 blocks with 2 (0 and 254) reserved but blocks still present
-#define DATA_REGION_SIZE (FAT_TABLE_SIZE * BLOCK_SIZE)  // data region is this many bytes large
-
-//file system definitions
-#define FILE_SYSTEM_SIZE (VOLUME_RECORD_SIZE + FAT_TABLE_SIZE + DIRECTORY_SIZE + DATA_REGION_SIZE)
-
-//Location variables
+#define FILE_TYPE_REGULAR 0
+#define FILE_TYPE_DIRECTORY 1
+#define PATH_SEPARATOR '/'
+#define NAME_INDEX_MIN_SLOTS 8  //smallest hash index, it always has at least twice as many slots as entries
+#define SUBDIR_MIN_SLOTS 4  //entry slots (and blocks) a subdirectory's in-memory entries have room for when first read
+#define DENTRY_CACHE_BUCKETS 4096   //buckets of the path resolution cache
+#define DENTRY_CACHE_MAX 65536  //cached entries kept before unused ones are dropped
+
+//descriptor table definitions, an fd is a slot of its volume's descriptor table tagged with the slot's generation
+#define FD_SLOT_BITS 16 //low bits of an fd give its slot, the bits above them the slot's generation
+#define MAX_OPEN_FILES (1 << FD_SLOT_BITS)  //most descriptors a volume can have open at once
+#define FD_GENERATION_MASK 0x7FFF   //generations wrap within the bits left so an fd is never negative
+#define FD_CHUNK_SLOTS 256  //slots the table grows by at a time
+
+//Location variables, the remaining regions follow at offsets that depend on the image's geometry
 #define VOLUME_RECORD_OFST 0   //offset from start of file to volume record
 #define FAT_REGION_OFST (VOLUME_RECORD_SIZE)   //offset from start of file to fat region
-#define ROOT_DIR_OFST (FAT_TABLE_SIZE + FAT_REGION_OFST)   //offset from start of file to root directory
-#define DATA_REGION_OFST (ROOT_DIR_OFST + DIRECTORY_SIZE) // offset from start of file to data region
+#define REGION_ALIGN 8  //every later region starts on a multiple of this many bytes
+
+//host transfer definitions
+#define TRANSFER_BATCH_BYTES (1 << 20)  //most bytes fs_import reads into a file's blocks with one readv
+
+//image building definitions
+#define BUILD_THREADS_MAX 64    //most threads make_fs_from reads source files with
+#define BUILD_LIST_MIN 256      //entries the scan list of make_fs_from starts with before it doubles
+
+//statistics definitions, the operations counted and timed by fs_stats
+#define STATS_OPEN 0
+#define STATS_CLOSE 1
+#define STATS_CREATE 2
+#define STATS_DELETE 3
+#define STATS_READ 4    //fs_read, fs_pread and fs_readv
+#define STATS_WRITE 5   //fs_write, fs_pwrite and fs_writev
+#define STATS_LSEEK 6
+#define STATS_SYNC 7    //every sync of a volume, made by closing a writer or by the calls that change a directory
+#define STATS_MKDIR 8
+#define STATS_RMDIR 9
+#define STATS_VIEW 10   //fs_read_view
+#define STATS_EXPORT 11
+#define STATS_IMPORT 12
+#define STATS_OPS 13
+#define STATS_LATENCY_BUCKETS 32    //bucket i counts calls taking from 2^i up to 2^(i+1) nanoseconds, the last also counts anything longer
+
+//vectored io definitions
+#ifndef IOV_MAX
+#define IOV_MAX 1024    //most vectors a single preadv/pwritev takes (not exposed by limits.h without _GNU_SOURCE)
+#endif
 
 //error handling definition
 #define SLEEP_USECS 500000
 
+//handle of a mounted volume, every operation takes the volume it works on
+typedef struct fileSystem fileSystem;
+
+//a read view, a byte range of a file as it sits in the volume's blocks (see fs_read_view)
+typedef struct readView {
+    struct iovec *iov;  //runs of the range in order, each points straight into the volume's storage
+    int iovcnt;
+    size_t bytes;   //total length of the runs
+    int fildes; //descriptor the view was taken through
+}readView;
+
+//counters of the library's work, each only ever grows so an interval is the difference of two snapshots
+typedef struct fsStats {
+    uint64_t calls[STATS_OPS];  //calls made of each operation, failed ones included
+    uint64_t latency[STATS_OPS][STATS_LATENCY_BUCKETS]; //histogram of how long each operation's calls took
+    uint64_t bytesRead; //bytes returned by read calls and views and copied out by exports
+    uint64_t bytesWritten;  //bytes taken by write calls and copied in by imports
+    uint64_t blocksAllocated;   //FAT indexes that went from free to used
+    uint64_t blocksFreed;   //FAT indexes that went from used to free
+    uint64_t syscalls;  //system calls made on images and host files and directories (the reads readdir makes are not seen)
+    uint64_t flushes;   //of those, the fsync, fdatasync and msync calls that made syncs durable
+}fsStats;
+
 // ----------housekeeping methods----------
 
-// function for generating file system
-int make_fs(char *store_name);                                                                                    //done
+// function for generating file system with blockCount blocks of blockSize bytes and room for maxFiles files
+int make_fs(char *store_name, int blockSize, int blockCount, int maxFiles);                                       //done
+
+//function for generating a file system holding a copy of the host directory tree at source_dir
+//the image is sized to fit the tree with spareBlocks free blocks and room for maxFiles root entries (more if the tree needs them)
+//the source files are read by up to threads threads and the image is written once
+int make_fs_from(char *store_name, char *source_dir, int blockSize, int maxFiles, int spareBlocks, int threads);
 
-//function for mounting the file system
-int mount_fs(char *store_name);                                                                                   //done
+//function for mounting the file system, flags are a mount mode or'd with a durability definition
+//returns the handle of the new volume or NULL if it cannot be mounted
+fileSystem *mount_fs(char *store_name, int flags);                                                               //done
+
+//Function for setting how long the DURABLE_GROUP commits of a volume wait for other syncs (GROUP_COMMIT_USECS until set)
+int fs_setCommitWindow(fileSystem *volume, useconds_t usecs);
 
 //Function for syncing the on disk fs with the in memory fs
 //int fs_sync();                                                                                                  //done
 
 //Function for un-mounting the file system
-int umount_fs();                                                                                   //done - needs tested
+int umount_fs(fileSystem *volume);                                                               //done - needs tested
 
 // ----------operations methods----------
+// names may be paths through subdirectories, components are separated by PATH_SEPARATOR
 
 //Function for creating the file system file
-int fs_create(char *name);                                                                                        //done
+int fs_create(fileSystem *volume, char *name);                                                                    //done
 
 //Function for deleting the file system
-int fs_delete(char *name);                                                                                        //done
+int fs_delete(fileSystem *volume, char *name);                                                                    //done
+
+//Function for creating an empty subdirectory
+int fs_mkdir(fileSystem *volume, char *path);
 
-//Function for getting the size (in bytes) of the fs
-int fs_filesize(char *name);
+//Function for deleting an empty subdirectory
+int fs_rmdir(fileSystem *volume, char *path);
 
-int fs_open(char *name, int mode);                                                                                //done
+//Function for getting the size (in bytes) of a file, -1 if it does not exist
+off_t fs_filesize(fileSystem *volume, char *name);
 
-int fs_close(int fildes);                                                                                         //done
+int fs_open(fileSystem *volume, char *name, int mode);                                                            //done
+
+int fs_close(fileSystem *volume, int fildes);                                                                     //done
 
 //Function for reading from the file system (stored as a file)
-int fs_read(int fildes, void *buf, size_t nbyte);
+ssize_t fs_read(fileSystem *volume, int fildes, void *buf, size_t nbyte);
 
 //Function for writing to the file system   (stored as a file)
-int fs_write(int fildes, void *buf, size_t nbyte);
+ssize_t fs_write(fileSystem *volume, int fildes, void *buf, size_t nbyte);
+
+//Functions for reading and writing at an offset, neither uses or moves the file pointer
+ssize_t fs_pread(fileSystem *volume, int fildes, void *buf, size_t nbyte, off_t offset);
+ssize_t fs_pwrite(fileSystem *volume, int fildes, void *buf, size_t nbyte, off_t offset);
+
+//Functions for reading into and writing from each buffer of an iovec array in turn, at the file pointer
+ssize_t fs_readv(fileSystem *volume, int fildes, const struct iovec *iov, int iovcnt);
+ssize_t fs_writev(fileSystem *volume, int fildes, const struct iovec *iov, int iovcnt);
+
+//Functions for reading a range of a file without copying it, the view's runs point into the volume's storage
+//writers to the file wait until the view is released, and the view's descriptor cannot be closed until then
+ssize_t fs_read_view(fileSystem *volume, int fildes, readView *view, size_t nbyte, off_t offset);
+int fs_release_view(fileSystem *volume, readView *view);
+
+//Functions for copying a whole file out to, or in from, a host file descriptor at its current position
+//fs_import creates the file (replacing one of the same name), both return the number of bytes copied
+ssize_t fs_export(fileSystem *volume, char *name, int host_fd);
+ssize_t fs_import(fileSystem *volume, int host_fd, char *name);
 
 //Function for setting the file position of the fs to the given offset                                            //done
-int fs_lseek(int fildes, off_t offset);
+off_t fs_lseek(fileSystem *volume, int fildes, off_t offset);
+
+//Function for reading the counters of every volume, summed over every thread that has used the library
+//each thread counts into its own counters so keeping them costs no locking on the operations themselves
+int fs_stats(fsStats *out);
 
 // ----------Testing methods----------
 
-void printVolumeBoot();
-void printFAT();
-void printDirectory();
-void printDataRegion();
-int incrementFileSize(char *name);
-void printFileDescriptors();
-int manualBlockSet(int fd, char *toSet);
+void printVolumeBoot(fileSystem *volume);
+void printFAT(fileSystem *volume);
+void printDirectory(fileSystem *volume);
+void printDataRegion(fileSystem *volume);
+int incrementFileSize(fileSystem *volume, char *name);
+void printFileDescriptors(fileSystem *volume);
+int manualBlockSet(fileSystem *volume, int fd, char *toSet);
 
 
 
@@ -2,26 +2,505 @@
 #include <string.h>
 #include "fs.h"
 
+//geometry of the image the behaviour checks run on, big enough for subdirectories and multi-block files
+#define CHECK_BLOCK_SIZE 64
+#define CHECK_BLOCK_COUNT 512
+#define CHECK_MAX_ENTRIES 16
+
+//threads writing files of their own in the concurrency check, and the rounds each makes
+#define CHECK_THREADS 4
+#define CHECK_ROUNDS 20
+
+//blocks each file of the extent check grows by, written in turns, and the blocks of the FAT-8 image, past the index read as free
+#define EXTENT_FILE_BLOCKS 40
+#define NARROW_BLOCK_COUNT 100
+#define NARROW_FILE_BLOCKS 60
+
+//geometry make_fs_from is given in the image building check, the block size is not the default on purpose
+#define BUILD_BLOCK_SIZE 128
+#define BUILD_SPARE_BLOCKS 16
+#define BUILD_THREADS 4
+
+//reports a failed check and fails the function making it
+#define CHECK(condition, what) do { if(!(condition)) { printf("check failed: %s\n", what); return ERR; } } while(0)
+
+//un-mounts the volume and mounts its image again with the same flags, so later checks read what was written to disk
+fileSystem *remount(fileSystem *volume, char *store, int flags) {
+    if(umount_fs(volume) == ERR) return NULL;
+    return mount_fs(store, flags);
+}
+
+//reads the whole of a file into buffer, returning how many bytes it held
+ssize_t readAll(fileSystem *volume, char *name, char *buffer, size_t nbyte) {
+    int fd = fs_open(volume, name, O_RDONLY);
+    if(fd == ERR) return ERR;
+    ssize_t got = fs_read(volume, fd, buffer, nbyte);
+    if(fs_close(volume, fd) == ERR) return ERR;
+    return got;
+}
+
+//views the first nbyte bytes of a file and fills lengths with the blocks each run of the view covers, returning the run count
+int viewRuns(fileSystem *volume, char *name, size_t nbyte, int blockSize, int *lengths, int max) {
+    readView view;
+    int fd = fs_open(volume, name, O_RDONLY);
+    if(fd == ERR) return ERR;
+    int runs = fs_read_view(volume, fd, &view, nbyte, 0) == (ssize_t) nbyte ? view.iovcnt : ERR;
+    for(int i = 0; i < runs && i < max; i++) lengths[i] = (int) (view.iov[i].iov_len / blockSize);
+    if(runs != ERR && fs_release_view(volume, &view) == ERR) runs = ERR;
+    if(fs_close(volume, fd) == ERR) return ERR;
+    return runs;
+}
+
+//pwrite and pread at offsets, neither moving the file pointer, and the write surviving a remount
+int checkOffsets(fileSystem **volume, char *store, int flags) {
+    int fd = fs_create(*volume, "offsets");
+    CHECK(fd != ERR, "create offsets");
+    CHECK(fs_write(*volume, fd, "hello world", 11) == 11, "write offsets");
+    CHECK(fs_pwrite(*volume, fd, "HELLO", 5, 0) == 5, "pwrite over the start");
+    CHECK(fs_write(*volume, fd, "!", 1) == 1, "write after pwrite lands at the end");
+    CHECK(fs_close(*volume, fd) == SUC, "close offsets");
+
+    CHECK((*volume = remount(*volume, store, flags)) != NULL, "remount after offsets");
+    char buffer[16] = {0};
+    fd = fs_open(*volume, "offsets", O_RDONLY);
+    CHECK(fs_pread(*volume, fd, buffer, 5, 6) == 5 && memcmp(buffer, "world", 5) == 0, "pread from the middle");
+    CHECK(fs_read(*volume, fd, buffer, sizeof(buffer)) == 12 && memcmp(buffer, "HELLO world!", 12) == 0, "read after pread starts at 0");
+    CHECK(fs_pread(*volume, fd, buffer, 4, 12) == 0, "pread at the end reads nothing");
+    CHECK(fs_close(*volume, fd) == SUC, "close offsets reader");
+    CHECK(fs_filesize(*volume, "offsets") == 12, "size of offsets");
+    return SUC;
+}
+
+//writev and readv across block boundaries, compared after a remount
+int checkVectors(fileSystem **volume, char *store, int flags) {
+    char first[100], second[50];
+    for(int i = 0; i < 100; i++) first[i] = (char) ('a' + i % 26);
+    for(int i = 0; i < 50; i++) second[i] = (char) ('0' + i % 10);
+    struct iovec out[2] = {{first, sizeof(first)}, {second, sizeof(second)}};
+
+    int fd = fs_create(*volume, "vectors");
+    CHECK(fd != ERR, "create vectors");
+    CHECK(fs_writev(*volume, fd, out, 2) == 150, "writev");
+    CHECK(fs_close(*volume, fd) == SUC, "close vectors");
+
+    CHECK((*volume = remount(*volume, store, flags)) != NULL, "remount after vectors");
+    char readFirst[70] = {0}, readSecond[80] = {0};
+    struct iovec in[2] = {{readFirst, sizeof(readFirst)}, {readSecond, sizeof(readSecond)}};
+    fd = fs_open(*volume, "vectors", O_RDONLY);
+    CHECK(fs_readv(*volume, fd, in, 2) == 150, "readv");
+    CHECK(memcmp(readFirst, first, 70) == 0, "readv first buffer");
+    CHECK(memcmp(readSecond, first + 70, 30) == 0 && memcmp(readSecond + 30, second, 50) == 0, "readv second buffer");
+    CHECK(fs_close(*volume, fd) == SUC, "close vectors reader");
+    return SUC;
+}
+
+//a read view covers the range asked for with runs pointing at the file's data, and holds its descriptor open
+int checkViews(fileSystem *volume) {
+    char data[200];
+    for(int i = 0; i < 200; i++) data[i] = (char) i;
+    int fd = fs_create(volume, "viewed");
+    CHECK(fd != ERR && fs_write(volume, fd, data, sizeof(data)) == 200, "write viewed");
+    CHECK(fs_close(volume, fd) == SUC, "close viewed");
+
+    readView view;
+    fd = fs_open(volume, "viewed", O_RDONLY);
+    CHECK(fs_read_view(volume, fd, &view, 150, 30) == 150 && view.bytes == 150, "view a range");
+    size_t at = 30;
+    for(int i = 0; i < view.iovcnt; i++) {
+        CHECK(memcmp(view.iov[i].iov_base, data + at, view.iov[i].iov_len) == 0, "view runs match the file");
+        at += view.iov[i].iov_len;
+    }
+    CHECK(at == 180, "view runs cover the range");
+    readView other;
+    CHECK(fs_read_view(volume, fd, &other, 10, 0) == 10 && fs_release_view(volume, &other) == SUC, "second view of the file");
+    CHECK(fs_release_view(volume, &view) == SUC, "release the first view");
+    CHECK(fs_close(volume, fd) == SUC, "close once the views are released");
+    return SUC;
+}
+
+//two files grown a block at a time in turns each sit in extents, every run between the first block and the tail is a whole one
+int checkExtents(fileSystem **volume, char *store, int flags) {
+    char *names[] = {"extent0", "extent1"};
+    char block[CHECK_BLOCK_SIZE], data[EXTENT_FILE_BLOCKS * CHECK_BLOCK_SIZE];
+    int fds[2], lengths[EXTENT_FILE_BLOCKS];
+    for(int f = 0; f < 2; f++) CHECK((fds[f] = fs_create(*volume, names[f])) != ERR, "create extent file");
+    for(int i = 0; i < EXTENT_FILE_BLOCKS; i++) {
+        for(int f = 0; f < 2; f++) {
+            memset(block, 'a' + (i + f) % 26, sizeof(block));
+            CHECK(fs_write(*volume, fds[f], block, sizeof(block)) == sizeof(block), "grow extent file");
+        }
+    }
+    for(int f = 0; f < 2; f++) CHECK(fs_close(*volume, fds[f]) == SUC, "close extent file");
+
+    CHECK((*volume = remount(*volume, store, flags)) != NULL, "remount after extents");
+    for(int f = 0; f < 2; f++) {
+        int runs = viewRuns(*volume, names[f], sizeof(data), CHECK_BLOCK_SIZE, lengths, EXTENT_FILE_BLOCKS);
+        CHECK(runs != ERR && runs <= EXTENT_FILE_BLOCKS / RESERVE_AHEAD_BLOCKS + 2, "extent file is in few runs");
+        for(int i = 1; i < runs - 1; i++) CHECK(lengths[i] >= RESERVE_AHEAD_BLOCKS, "extent file runs are whole extents");
+        CHECK(readAll(*volume, names[f], data, sizeof(data)) == sizeof(data), "read extent file");
+        for(int i = 0; i < EXTENT_FILE_BLOCKS; i++) CHECK(data[i * CHECK_BLOCK_SIZE] == 'a' + (i + f) % 26, "extent file contents");
+        CHECK(fs_delete(*volume, names[f]) == SUC, "delete extent file");
+    }
+    return SUC;
+}
+
+//a file copied in from a host file and back out again is unchanged, as is its size after a remount
+int checkTransfer(fileSystem **volume, char *store, int flags) {
+    char data[1000], back[1000];
+    for(int i = 0; i < 1000; i++) data[i] = (char) (i * 7);
+    FILE *host = tmpfile();
+    CHECK(host != NULL && fwrite(data, 1, sizeof(data), host) == sizeof(data) && fflush(host) == 0, "write host file");
+    int hostFd = fileno(host);
+
+    CHECK(lseek(hostFd, 0, SEEK_SET) == 0 && fs_mkdir(*volume, "in") == SUC, "make import directory");
+    CHECK(fs_import(*volume, hostFd, "in/copy") == 1000, "import");
+    CHECK((*volume = remount(*volume, store, flags)) != NULL, "remount after import");
+    CHECK(fs_filesize(*volume, "in/copy") == 1000, "size of import");
+    CHECK(readAll(*volume, "in/copy", back, sizeof(back)) == 1000 && memcmp(back, data, 1000) == 0, "imported data");
+
+    CHECK(ftruncate(hostFd, 0) == 0 && lseek(hostFd, 0, SEEK_SET) == 0, "empty host file");
+    CHECK(fs_export(*volume, "in/copy", hostFd) == 1000, "export");
+    CHECK(pread(hostFd, back, sizeof(back), 0) == 1000 && memcmp(back, data, 1000) == 0, "exported data");
+    fclose(host);
+    return SUC;
+}
+
+//directories nest, hold files by path and can only be removed once empty
+int checkDirectories(fileSystem **volume, char *store, int flags) {
+    CHECK(fs_mkdir(*volume, "d") == SUC && fs_mkdir(*volume, "d/e") == SUC, "mkdir");
+    int fd = fs_create(*volume, "d/e/f");
+    CHECK(fd != ERR && fs_write(*volume, fd, "nested", 6) == 6 && fs_close(*volume, fd) == SUC, "write nested file");
+    for(int i = 0; i < 20; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "d/g%d", i);
+        CHECK((fd = fs_create(*volume, name)) != ERR && fs_close(*volume, fd) == SUC, "fill a subdirectory");
+    }
+
+    CHECK((*volume = remount(*volume, store, flags)) != NULL, "remount after mkdir");
+    char buffer[8] = {0};
+    CHECK(readAll(*volume, "d/e/f", buffer, sizeof(buffer)) == 6 && memcmp(buffer, "nested", 6) == 0, "nested file by path");
+    CHECK(readAll(*volume, "/d//e/f", buffer, sizeof(buffer)) == 6, "separators are collapsed");
+    CHECK(fs_filesize(*volume, "d/g19") == 0, "last file of the subdirectory");
+
+    CHECK(fs_delete(*volume, "d/e/f") == SUC && fs_rmdir(*volume, "d/e") == SUC, "rmdir once empty");
+    for(int i = 0; i < 20; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "d/g%d", i);
+        CHECK(fs_delete(*volume, name) == SUC, "empty a subdirectory");
+    }
+    CHECK(fs_rmdir(*volume, "d") == SUC, "rmdir the emptied subdirectory");
+    CHECK((*volume = remount(*volume, store, flags)) != NULL, "remount after rmdir");
+    CHECK(fs_filesize(*volume, "d") == ERR, "removed directory stays removed");
+    return SUC;
+}
+
+//the counters move by the calls made, whichever thread reads them
+int checkStats(fileSystem *volume, int flags) {
+    fsStats before, after;
+    CHECK(fs_stats(&before) == SUC, "read stats");
+    int fd = fs_create(volume, "counted");
+    CHECK(fd != ERR && fs_write(volume, fd, "abc", 3) == 3 && fs_write(volume, fd, "de", 2) == 2, "counted writes");
+    CHECK(fs_close(volume, fd) == SUC, "counted close");
+    CHECK(fs_stats(&after) == SUC, "read stats again");
+
+    CHECK(after.calls[STATS_CREATE] - before.calls[STATS_CREATE] == 1, "create counted");
+    CHECK(after.calls[STATS_WRITE] - before.calls[STATS_WRITE] == 2, "writes counted");
+    CHECK(after.calls[STATS_CLOSE] - before.calls[STATS_CLOSE] == 1, "close counted");
+    CHECK(after.calls[STATS_SYNC] > before.calls[STATS_SYNC], "sync counted");
+    CHECK(after.bytesWritten - before.bytesWritten == 5, "bytes written counted");
+    //a mapped image left for the kernel to flush is written without any system calls
+    int silent = (flags & MOUNT_MODE_MASK) == MOUNT_MMAP && (flags & DURABILITY_MASK) == DURABLE_NONE;
+    CHECK(silent || after.syscalls > before.syscalls, "system calls counted");
+    return SUC;
+}
+
+//calls given bad descriptors or offsets fail without changing anything
+int checkErrors(fileSystem *volume) {
+    char buffer[8];
+    CHECK(fs_read(volume, 12345, buffer, 1) == ERR, "read of a bad fd");
+    CHECK(fs_close(volume, -1) == ERR, "close of a bad fd");
+
+    int fd = fs_create(volume, "errors");
+    CHECK(fd != ERR && fs_write(volume, fd, "x", 1) == 1, "create errors");
+    CHECK(fs_read(volume, fd, buffer, 1) == ERR, "read of a writer");
+    CHECK(fs_pwrite(volume, fd, "x", 1, 5) == ERR, "pwrite past the end");
+    CHECK(fs_close(volume, fd) == SUC, "close errors");
+    CHECK(fs_write(volume, fd, "x", 1) == ERR, "write to a closed fd");
+    return SUC;
+}
+
+//a descriptor cannot be closed while a view taken through it is held, and a view is only released once
+int checkViewErrors(fileSystem *volume) {
+    int fd = fs_create(volume, "view-errors");
+    CHECK(fd != ERR && fs_write(volume, fd, "x", 1) == 1 && fs_close(volume, fd) == SUC, "create view errors");
+
+    readView view;
+    fd = fs_open(volume, "view-errors", O_RDONLY);
+    CHECK(fs_read_view(volume, fd, &view, 1, 0) == 1, "view errors");
+    CHECK(fs_close(volume, fd) == ERR, "close while a view is held");
+    CHECK(fs_release_view(volume, &view) == SUC && fs_release_view(volume, &view) == ERR, "release a view twice");
+    CHECK(fs_close(volume, fd) == SUC, "close after release");
+    return SUC;
+}
+
+//a directory in use cannot be removed, a file cannot be removed as a directory and a directory cannot be opened
+int checkDirectoryErrors(fileSystem *volume) {
+    int fd;
+    CHECK(fs_mkdir(volume, "full") == SUC && (fd = fs_create(volume, "full/f")) != ERR && fs_close(volume, fd) == SUC, "fill a directory");
+    CHECK(fs_rmdir(volume, "full") == ERR, "rmdir of a non-empty directory");
+    CHECK(fs_rmdir(volume, "full/f") == ERR, "rmdir of a file");
+    CHECK(fs_open(volume, "full", O_RDONLY) == ERR, "open of a directory");
+    return SUC;
+}
+
+//an image cut short after it was made is refused by both mount modes rather than mounted with missing blocks
+int checkShortImage(char *store) {
+    CHECK(make_fs(store, CHECK_BLOCK_SIZE, CHECK_BLOCK_COUNT, CHECK_MAX_ENTRIES) == SUC, "make short image");
+    CHECK(truncate(store, 4096) == 0, "cut the image short");
+    CHECK(mount_fs(store, MOUNT_BUFFERED) == NULL, "buffered mount of a short image");
+    CHECK(mount_fs(store, MOUNT_MMAP) == NULL, "mapped mount of a short image");
+    remove(store);
+    printf("short image checks: passed\n");
+    return SUC;
+}
+
+//a file of a FAT-8 image growing past block 48 skips it, as the index would read as free, and reads back whole in both modes
+int checkNarrowFat(char *store) {
+    char data[NARROW_FILE_BLOCKS * CHECK_BLOCK_SIZE], back[sizeof(data)];
+    int modes[] = {MOUNT_BUFFERED, MOUNT_MMAP}, lengths[NARROW_FILE_BLOCKS];
+    for(int i = 0; i < (int) sizeof(data); i++) data[i] = (char) (i * 7 + i / CHECK_BLOCK_SIZE);
+    for(int m = 0; m < 2; m++) {
+        CHECK(make_fs(store, CHECK_BLOCK_SIZE, NARROW_BLOCK_COUNT, CHECK_MAX_ENTRIES) == SUC, "make FAT-8 image");
+        fileSystem *volume = mount_fs(store, modes[m]);
+        CHECK(volume != NULL, "mount FAT-8 image");
+        int fd = fs_create(volume, "narrow");
+        CHECK(fd != ERR && fs_write(volume, fd, data, sizeof(data)) == sizeof(data), "write past block 48");
+        CHECK(fs_close(volume, fd) == SUC, "close narrow");
+
+        CHECK((volume = remount(volume, store, modes[m])) != NULL, "remount FAT-8 image");
+        CHECK(fs_filesize(volume, "narrow") == sizeof(data), "size of narrow");
+        CHECK(readAll(volume, "narrow", back, sizeof(back)) == sizeof(back) && memcmp(back, data, sizeof(data)) == 0, "narrow contents");
+        int runs = viewRuns(volume, "narrow", sizeof(data), CHECK_BLOCK_SIZE, lengths, NARROW_FILE_BLOCKS);
+        CHECK(runs == 2 && lengths[0] == FAT8_FREE - FIRST_FAT_INDEX, "narrow breaks only at block 48");
+        CHECK(umount_fs(volume) == SUC, "un-mount FAT-8 image");
+        remove(store);
+    }
+    printf("FAT-8 image checks: passed\n");
+    return SUC;
+}
+
+//what the threads of the concurrency check share, the fd readers use is swapped under them by the main thread
+typedef struct threadCheck {
+    fileSystem *volume;
+    int index;
+    int *sharedFd;
+    int *stop;
+    int *failed;
+}threadCheck;
+
+//rewrites a file of the thread's own each round and checks its size and contents straight after
+void *checkWriter(void *arg) {
+    threadCheck *t = arg;
+    char name[FILE_NAME_SIZE], out[300], in[300];
+    snprintf(name, sizeof(name), "threads/w%d", t->index);
+    for(int round = 0; round < CHECK_ROUNDS; round++) {
+        memset(out, 'a' + (round + t->index) % 26, sizeof(out));
+        int fd = fs_create(t->volume, name);
+        int ok = fd != ERR && fs_write(t->volume, fd, out, 200) == 200 && fs_pwrite(t->volume, fd, out, 150, 150) == 150;
+        ok = fs_close(t->volume, fd) == SUC && ok;
+        ok = ok && fs_filesize(t->volume, name) == 300 && readAll(t->volume, name, in, sizeof(in)) == 300 && memcmp(in, out, 300) == 0;
+        if(!ok) __atomic_store_n(t->failed, TRUE, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+//makes and removes a directory and reads sizes while the writers run, none of which waits for their writes
+void *checkMetadata(void *arg) {
+    threadCheck *t = arg;
+    for(int round = 0; round < CHECK_ROUNDS * 2; round++) {
+        fs_filesize(t->volume, "threads/w0");
+        if(fs_mkdir(t->volume, "threads/m") == ERR || fs_rmdir(t->volume, "threads/m") == ERR) __atomic_store_n(t->failed, TRUE, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+//reads through whichever fd is current, a read may find it closed but must never see the wrong bytes
+void *checkReader(void *arg) {
+    threadCheck *t = arg;
+    char in[64];
+    while(!__atomic_load_n(t->stop, __ATOMIC_RELAXED)) {
+        ssize_t got = fs_pread(t->volume, __atomic_load_n(t->sharedFd, __ATOMIC_RELAXED), in, sizeof(in), 0);
+        if(got != ERR && (got != sizeof(in) || memcmp(in, "shared shared shared", 20) != 0)) __atomic_store_n(t->failed, TRUE, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+/*
+ * runs writers, a metadata thread and readers on one volume at once while the main thread closes and reopens
+ * the fd the readers use, so the locking and descriptor references are exercised under contention
+ */
+int checkThreads(fileSystem *volume) {
+    char shared[64] = "shared shared shared";
+    int fd = fs_create(volume, "shared");
+    CHECK(fd != ERR && fs_write(volume, fd, shared, sizeof(shared)) == sizeof(shared) && fs_close(volume, fd) == SUC, "write shared file");
+    CHECK(fs_mkdir(volume, "threads") == SUC, "make thread directory");
+
+    int sharedFd = fs_open(volume, "shared", O_RDONLY), stop = FALSE, failed = FALSE;
+    pthread_t threads[CHECK_THREADS + 3];
+    threadCheck args[CHECK_THREADS + 3];
+    for(int i = 0; i < CHECK_THREADS + 3; i++) {
+        args[i] = (threadCheck) {volume, i, &sharedFd, &stop, &failed};
+        void *(*run)(void *) = i < CHECK_THREADS ? checkWriter : i == CHECK_THREADS ? checkMetadata : checkReader;
+        CHECK(pthread_create(&threads[i], NULL, run, &args[i]) == 0, "start thread");
+    }
+    for(int round = 0; round < CHECK_ROUNDS * 10; round++) {
+        int old = sharedFd;
+        __atomic_store_n(&sharedFd, fs_open(volume, "shared", O_RDONLY), __ATOMIC_RELAXED);
+        if(fs_close(volume, old) == ERR) failed = TRUE;
+    }
+    for(int i = 0; i < CHECK_THREADS + 1; i++) pthread_join(threads[i], NULL);
+    __atomic_store_n(&stop, TRUE, __ATOMIC_RELAXED);
+    for(int i = CHECK_THREADS + 1; i < CHECK_THREADS + 3; i++) pthread_join(threads[i], NULL);
+
+    CHECK(fs_close(volume, sharedFd) == SUC, "close shared file");
+    CHECK(!failed, "threads see their own writes and only valid fds");
+    return SUC;
+}
+
+//the files of the host tree the image building check copies in, as paths under the tree and sizes, the directories first
+static const char *buildDirs[] = {"a", "a/b", "a/many"};
+static const char *buildFiles[] = {"top", "empty", "a/mid", "a/b/deep", "a/many/f0", "a/many/f1", "a/many/f2",
+                                   "a/many/f3", "a/many/f4", "a/many/f5", "a/many/f6", "a/many/f7"};
+static const int buildSizes[] = {1000, 0, 130, 300, 1, 127, 128, 129, 255, 256, 257, 5000};
+#define BUILD_LONG_NAME "a-name-longer-than-an-entry-holds"
+
+//fills buffer with the bytes the build check's file number index holds
+void buildData(char *buffer, int bytes, int index) {
+    for(int i = 0; i < bytes; i++) buffer[i] = (char) (i * 31 + index);
+}
+
+/*
+ * builds an image from a host tree of nested directories with make_fs_from, using several threads and a block size
+ * that is not the default, then mounts it both ways and checks every file holds what the host file did,
+ * that a name too long for an entry was left out and that the spare blocks can be written to
+ */
+int checkBuild(char *store) {
+    char root[] = "/tmp/fs-build-XXXXXX", path[PATH_MAX], data[5000], back[5000];
+    CHECK(mkdtemp(root) != NULL, "make host tree");
+    int count = (int) (sizeof(buildFiles) / sizeof(buildFiles[0])), dirs = (int) (sizeof(buildDirs) / sizeof(buildDirs[0]));
+    for(int i = 0; i < dirs; i++) {
+        snprintf(path, sizeof(path), "%s/%s", root, buildDirs[i]);
+        CHECK(mkdir(path, 0777) == 0, "make host directory");
+    }
+    for(int i = 0; i <= count; i++) {
+        int bytes = i < count ? buildSizes[i] : 10;
+        snprintf(path, sizeof(path), "%s/%s", root, i < count ? buildFiles[i] : BUILD_LONG_NAME);
+        buildData(data, bytes, i);
+        FILE *host = fopen(path, "w");
+        CHECK(host != NULL && fwrite(data, 1, bytes, host) == (size_t) bytes && fclose(host) == 0, "write host file");
+    }
+
+    int res = make_fs_from(store, root, BUILD_BLOCK_SIZE, CHECK_MAX_ENTRIES, BUILD_SPARE_BLOCKS, BUILD_THREADS);
+    int modes[] = {MOUNT_BUFFERED, MOUNT_MMAP};
+    for(int m = 0; m < 2 && res == SUC; m++) {
+        fileSystem *volume = mount_fs(store, modes[m]);
+        if(volume == NULL) res = ERR;
+        for(int i = 0; i < count && res == SUC; i++) {
+            buildData(data, buildSizes[i], i);
+            if(fs_filesize(volume, (char *) buildFiles[i]) != buildSizes[i] ||
+               readAll(volume, (char *) buildFiles[i], back, sizeof(back)) != buildSizes[i] || memcmp(back, data, buildSizes[i]) != 0) {
+                printf("check failed: built file %s\n", buildFiles[i]);
+                res = ERR;
+            }
+        }
+        if(res == SUC && fs_filesize(volume, BUILD_LONG_NAME) != ERR) res = ERR;
+        char *added = m == 0 ? "a/b/added0" : "a/b/added1";
+        int fd = res == SUC ? fs_create(volume, added) : ERR;
+        if(fd == ERR || fs_write(volume, fd, data, BUILD_BLOCK_SIZE * 4) != BUILD_BLOCK_SIZE * 4 || fs_close(volume, fd) == ERR) res = ERR;
+        if(volume != NULL && umount_fs(volume) == ERR) res = ERR;
+    }
+
+    for(int i = 0; i <= count; i++) {
+        snprintf(path, sizeof(path), "%s/%s", root, i < count ? buildFiles[i] : BUILD_LONG_NAME);
+        remove(path);
+    }
+    for(int i = dirs - 1; i >= 0; i--) {
+        snprintf(path, sizeof(path), "%s/%s", root, buildDirs[i]);
+        rmdir(path);
+    }
+    rmdir(root);
+    remove(store);
+    CHECK(res == SUC, "image built from a host tree");
+    printf("image building checks: passed\n");
+    return SUC;
+}
+
+//runs every behaviour check on a fresh image mounted with the given flags
+int checkMount(char *store, int flags, int errors) {
+    if(make_fs(store, CHECK_BLOCK_SIZE, CHECK_BLOCK_COUNT, CHECK_MAX_ENTRIES) == ERR) return ERR;
+    fileSystem *volume = mount_fs(store, flags);
+    CHECK(volume != NULL, "mount");
+    if((flags & DURABILITY_MASK) == DURABLE_GROUP) CHECK(fs_setCommitWindow(volume, 1000) == SUC, "set commit window");
+
+    int res = SUC;
+    if(res == SUC) res = checkOffsets(&volume, store, flags);
+    if(res == SUC) res = checkVectors(&volume, store, flags);
+    if(res == SUC) res = checkViews(volume);
+    if(res == SUC) res = checkExtents(&volume, store, flags);
+    if(res == SUC) res = checkTransfer(&volume, store, flags);
+    if(res == SUC) res = checkDirectories(&volume, store, flags);
+    if(res == SUC) res = checkStats(volume, flags);
+    if(res == SUC && errors) res = checkErrors(volume);
+    if(res == SUC && errors) res = checkViewErrors(volume);
+    if(res == SUC && errors) res = checkDirectoryErrors(volume);
+    if(res == SUC) res = checkThreads(volume);
+    if(volume != NULL && umount_fs(volume) == ERR) res = ERR;
+    remove(store);
+
+    printf("checks with mount flags %#x: %s\n", flags, res == SUC ? "passed" : "failed");
+    return res;
+}
+
 int main() {
     char *store = "a.txt";
-    if(make_fs(store) == ERR) return ERR;
-    if(mount_fs(store) == ERR) return ERR;
+    if(make_fs(store, DEFAULT_BLOCK_SIZE, DEFAULT_BLOCK_COUNT, DEFAULT_MAX_ENTRIES) == ERR) return ERR;
+    fileSystem *volume = mount_fs(store, MOUNT_BUFFERED);
+    if(volume == NULL) return ERR;
 
-    int fd1 = fs_create("file1");
-    int fd2 = fs_create("file2");
+    int fd1 = fs_create(volume, "file1");
+    int fd2 = fs_create(volume, "file2");
 
     int test1 = 12;
     char test2[] = {'a', 'b', 'c', 'd'};
     char *test3 = "The Heart Relentless beats";
     long test4 = 1234567891011121314;
 
-    fs_write(fd1, &test1, 2);
-    fs_write(fd2, test2, 4);
-    fs_write(fd1, test3, 26);
-    fs_write(fd2, &test4, 19);
+    fs_write(volume, fd1, &test1, 2);
+    fs_write(volume, fd2, test2, 4);
+    fs_write(volume, fd1, test3, 26);
+    fs_write(volume, fd2, &test4, sizeof(test4));
+
+    printDirectory(volume);
+    printDataRegion(volume);
+
+    //read the text back from after the int written before it
+    char read3[27] = {0};
+    fs_close(volume, fd1);
+    fd1 = fs_open(volume, "file1", O_RDONLY);
+    fs_lseek(volume, fd1, 2);
+    fs_read(volume, fd1, read3, 26);
+    printf("read back: %s\n", read3);
+    if(strcmp(read3, test3) != 0) return ERR;
+    if(fs_close(volume, fd1) == ERR || fs_close(volume, fd2) == ERR || umount_fs(volume) == ERR) return ERR;
 
-    printDirectory();
-    printDataRegion();
+    //the behaviour checks run under every mount mode and durability, the error paths once
+    int modes[] = {MOUNT_BUFFERED | DURABLE_FSYNC, MOUNT_MMAP | DURABLE_DATA, MOUNT_BUFFERED | DURABLE_GROUP, MOUNT_MMAP | DURABLE_NONE};
+    for(int i = 0; i < (int) (sizeof(modes) / sizeof(modes[0])); i++) {
+        if(checkMount("checks.img", modes[i], i == 0) == ERR) return ERR;
+    }
+    if(checkShortImage("checks.img") == ERR) return ERR;
+    if(checkNarrowFat("checks.img") == ERR) return ERR;
+    if(checkBuild("checks.img") == ERR) return ERR;
 
     return SUC;
 }
@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <string.h>
+#include "fs.h"
+
+//defaults for images built by the tool, an image of real files wants far larger blocks than the demo geometry
+#define MKIMAGE_BLOCK_SIZE 4096
+#define MKIMAGE_SPARE_BLOCKS 0
+
+void usage(char *program) {
+    fprintf(stderr, "usage: %s [-b block size] [-n root entries] [-s spare blocks] [-j threads] image source_dir\n", program);
+}
+
+/*
+ * builds an image holding a copy of a host directory tree (see make_fs_from)
+ * the root directory has room for at least -n entries and -s free blocks are left for the image to grow into,
+ * the source files are read by -j threads (one per online processor by default)
+ */
+int main(int argc, char **argv) {
+    int blockSize = MKIMAGE_BLOCK_SIZE;
+    int maxFiles = DEFAULT_MAX_ENTRIES;
+    int spareBlocks = MKIMAGE_SPARE_BLOCKS;
+    int threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "b:n:s:j:")) != -1) {
+        switch (opt) {
+            case 'b': blockSize = atoi(optarg); break;
+            case 'n': maxFiles = atoi(optarg); break;
+            case 's': spareBlocks = atoi(optarg); break;
+            case 'j': threads = atoi(optarg); break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (make_fs_from(argv[optind], argv[optind + 1], blockSize, maxFiles, spareBlocks, threads) == ERR) return 1;
+    return 0;
+}